@@ -17,20 +17,74 @@ enum seg_state {
     PENDING_DEL            // Segment is marked for deletion in next commit
 };
 
+// A piece of the document: a span of one of the document's immutable 
+// text buffers. Spans of up to SEG_INLINE_MAX bytes are instead copied 
+// into inline_text, allocated together with the node, so short inserts 
+// and formatting markers cost one allocation and one cache miss
+#define SEG_INLINE_MAX 24
+
 typedef struct text_segment {
-    char* content;                     // Text content of this segment
-    size_t length;                     // Length of the text content
+    const char* content;               // Start of the text, not NUL 
+                                      // terminated
+    size_t length;                     // Length of the text
     enum seg_state state;              // Current state of this segment
     struct text_segment *next_segment; // Pointer to next segment in the list
+    char inline_text[];                // Short text, if content points here
 } text_segment;
 
+struct pos_index;
+struct text_block;
+struct md_undo;
+
+// Memory accounting for one document, kept up to date by every segment 
+// allocation, split, state change and free. Read it with markdown_stats
+typedef struct {
+    size_t segments[3];          // Live segments, indexed by seg_state
+    size_t committed_segments;   // Segments in the committed list
+    size_t working_segments;     // Segments in the working list
+    size_t content_bytes;        // Text bytes referenced by all segments
+    size_t content_alloc_bytes;  // Bytes allocated for text buffers and
+                                 // inline text
+    size_t buffer_bytes;         // Bytes written to text buffers and 
+                                 // inline text
+    size_t working_bytes;        // Text bytes referenced by the working 
+                                 // list
+    size_t overhead_bytes;       // Segment headers, index and document
+    double fragmentation;        // Share of written buffer bytes the 
+                                 // committed document no longer uses
+} md_stats;
+
+// Cached walk state in the working list: seg starts at committed offset 
+// seen and follows prev (NULL at the head). Edits leave it next to the 
+// text they touched, so nearby edits resume from there instead of the 
+// head. Cleared whenever the working list is rebuilt or committed
+typedef struct {
+    text_segment *prev;
+    text_segment *seg;
+    size_t seen;
+} seg_finger;
+
 typedef struct {
     text_segment *committed_head;      // Starting point of the committed 
                                       // document version
     text_segment *working_head;        // Starting point of the working 
                                       // document version
+    size_t working_base;               // Committed offset working_head 
+                                      // starts at: 0, or a shard's start
     size_t total_length;               // Total length of the document 
     uint64_t current_version;          // Current version number
+    struct pos_index *pos_index;       // Byte/code-point index over the 
+                                      // committed list, built on first 
+                                      // use and patched at each commit
+    struct text_block *original;       // Immutable buffer the committed 
+                                      // text was last compacted into
+    struct text_block *add_head;       // Append-only buffer for inserted 
+    struct text_block *add_tail;       // text, as a list of blocks
+    md_stats stats;                    // Memory counters
+    seg_finger finger;                 // Last edit position in the 
+                                      // working list
+    struct md_undo *undo;              // Working-list changes since 
+                                      // markdown_savepoint, or NULL
 } document; 
 
 #define SUCCESS 0
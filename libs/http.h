@@ -0,0 +1,45 @@
+#ifndef HTTP_H
+#define HTTP_H
+#include <stddef.h>
+
+/**
+ * Minimal HTTP/1.1 front end. One thread runs an epoll loop over the
+ * listening socket and every connection; connections are keep-alive and
+ * pipelined requests are answered in order. Each complete request is
+ * passed to a handler that fills in a response. Bodies are bounded and
+ * chunked request bodies are not supported.
+ */
+
+#define HTTP_MAX_HEADER_LEN (16 * 1024)
+#define HTTP_MAX_BODY_LEN (1024 * 1024)
+
+typedef struct {
+    const char *method;     // "GET", "POST", ...
+    const char *path;       // Path without the query string
+    const char *query;      // Text after '?', or ""
+    const char *body;
+    size_t body_len;
+} http_request;
+
+typedef struct {
+    int status;
+    const char *content_type;
+    char *body;             // malloc'd, freed by the HTTP layer
+    size_t body_len;
+} http_response;
+
+typedef void (*http_handler)(const http_request *req, http_response *resp,
+                             void *ctx);
+
+// Listen on addr:port and serve requests with handler on a background
+// thread. Returns 0 on success, -1 if the socket could not be set up
+int http_server_start(const char *addr, int port, http_handler handler,
+                      void *ctx);
+void http_server_stop(void);
+
+// Copy the value of name from a query string into out. Returns 0 if the
+// parameter is present
+int http_query_param(const char *query, const char *name, char *out,
+                     size_t cap);
+
+#endif // HTTP_H
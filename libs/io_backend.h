@@ -0,0 +1,29 @@
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Batched output for the server. When the kernel supports io_uring, every
+ * write of a broadcast fan-out is queued on one ring and submitted with a
+ * single io_uring_enter; persistence writes go through the same ring.
+ * Otherwise each write is issued with plain write(2).
+ */
+
+#define IO_BACKEND_WRITE 0
+#define IO_BACKEND_URING 1
+
+// Set up the backend. Pass 0 to force plain writes. Returns the backend
+// actually in use
+int io_backend_init(int allow_uring);
+void io_backend_shutdown(void);
+const char *io_backend_name(void);
+
+// Write the same buffer to every descriptor in fds
+void io_backend_fanout(const int *fds, size_t count, const void *buf,
+                       size_t len);
+
+// Write a whole buffer to fd, returns bytes written or -1 on error
+ssize_t io_backend_write_all(int fd, const void *buf, size_t len);
+
+#endif // IO_BACKEND_H
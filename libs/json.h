@@ -0,0 +1,48 @@
+#ifndef JSON_H
+#define JSON_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Streaming JSON writer. Values are appended straight into one growable
+ * buffer as they are produced; commas and nesting are tracked with a 
+ * small stack, so no object tree is ever built. Also a minimal reader 
+ * for the flat request objects the HTTP gateway accepts.
+ */
+
+#define JSON_MAX_DEPTH 32
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int depth;
+    unsigned char has_items[JSON_MAX_DEPTH]; // Needs a comma before next
+    int after_key;                           // Next value follows a key
+} json_writer;
+
+void json_init(json_writer *w);
+void json_free(json_writer *w);
+
+// Hand the finished text to the caller, who frees it
+char *json_release(json_writer *w, size_t *len);
+
+void json_object_begin(json_writer *w);
+void json_object_end(json_writer *w);
+void json_array_begin(json_writer *w);
+void json_array_end(json_writer *w);
+void json_key(json_writer *w, const char *key);
+
+void json_string(json_writer *w, const char *s);
+void json_string_len(json_writer *w, const char *s, size_t len);
+void json_uint(json_writer *w, uint64_t v);
+void json_double(json_writer *w, double v);
+void json_bool(json_writer *w, int v);
+
+// Look up a string member of a flat JSON object and decode it into out.
+// Returns 0 on success, -1 if the key is missing, not a string, too long
+// for out, or the text is not a flat object
+int json_get_string(const char *json, size_t len, const char *key, 
+                    char *out, size_t cap);
+
+#endif // JSON_H
@@ -0,0 +1,30 @@
+#ifndef LZ_H
+#define LZ_H
+#include <stddef.h>
+
+/**
+ * Small LZ77 block codec in the style of LZ4, used to compress large
+ * broadcast frames once and share the result across subscribers.
+ *
+ * A block is a series of sequences. Each starts with a token byte whose
+ * high nibble is the literal count and low nibble the match length minus
+ * LZ_MIN_MATCH (a nibble of 15 continues in following bytes, 255 at a
+ * time). Then come the literals, a 2-byte little-endian match offset and
+ * any match length extension. The final sequence has literals only.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+// Worst-case compressed size for len input bytes
+size_t lz_compress_bound(size_t len);
+
+// Compress src into dst. Returns the compressed size, or 0 if it does not
+// fit in cap
+size_t lz_compress(const char *src, size_t len, char *dst, size_t cap);
+
+// Decompress a block. Returns the decompressed size, or -1 if the block
+// is malformed or does not fit in cap
+long lz_decompress(const char *src, size_t len, char *dst, size_t cap);
+
+#endif // LZ_H
@@ -23,6 +23,28 @@ int markdown_insert(document *doc, uint64_t version, size_t pos,
 int markdown_delete(document *doc, uint64_t version, size_t pos, 
                    size_t len);
 
+// One insert or delete applied at many committed positions (e.g. one per
+// cursor) in a single ordered pass. Either all positions are valid and 
+// every edit is applied, or nothing changes
+int markdown_multi_insert(document *doc, uint64_t version, 
+                          const char *content, const size_t *positions, 
+                          size_t count);
+int markdown_multi_delete(document *doc, uint64_t version, size_t len, 
+                          const size_t *positions, size_t count);
+
+// Move or copy the committed range [start, start + len) to dest, by 
+// relinking the range's segments rather than copying its text
+int markdown_move(document *doc, uint64_t version, size_t start, size_t len,
+                  size_t dest);
+int markdown_copy(document *doc, uint64_t version, size_t start, size_t len,
+                  size_t dest);
+
+// Replace every occurrence of needle in the committed document, found in
+// one scan. The number of matches is stored in count if non-NULL
+int markdown_replace_all(document *doc, uint64_t version, 
+                         const char *needle, const char *replacement, 
+                         size_t *count);
+
 // === Formatting Commands ===
 int markdown_newline(document *doc, uint64_t version, size_t pos);
 int markdown_heading(document *doc, uint64_t version, size_t level, 
@@ -44,7 +66,99 @@ int markdown_link(document *doc, uint64_t version, size_t start, size_t end,
 void markdown_print(const document *doc, FILE *stream);
 char *markdown_flatten(const document *doc);
 
+// Flatten plus the Adler-32 checksum of the text, computed in the same 
+// pass. Documents over a few MB are copied by parallel workers
+char *markdown_flatten_checksum(const document *doc, size_t *len, 
+                                uint32_t *adler);
+
+// Memory used by the document: segments by state, content and overhead
+// bytes, working-list size and fragmentation. O(1)
+void markdown_stats(const document *doc, md_stats *stats);
+
 // === Versioning ===
 void markdown_increment_version(document *doc);
 
+// Forget the pending edits of the current version without committing
+void markdown_discard_pending(document *doc);
+
+// === Savepoints ===
+
+// Start recording changes to the working list, so a group of edits (a 
+// transaction) can be undone without touching pending edits made before
+// it. One savepoint at a time, and none while shards are split off
+void markdown_savepoint(document *doc);
+
+// Undo every change since markdown_savepoint and stop recording. The 
+// cost follows the changes undone, not the document or the edits before
+// the savepoint
+void markdown_rollback(document *doc);
+
+// Keep the changes since markdown_savepoint and stop recording
+void markdown_release(document *doc);
+
+// === Region shards ===
+
+// One position range of the working list, [start, end) in committed 
+// coordinates, as a document of its own. An edit whose positions all 
+// fall inside one shard's range (end itself only for the last shard) can
+// be applied to shard->doc with the markdown_* edit functions, and 
+// different shards on different threads. markdown_heading, 
+// markdown_ordered_list and the multi-position, move, copy and replace 
+// commands need the whole document
+typedef struct {
+    document doc;
+    size_t start;
+    size_t end;
+    text_segment *tail;    // Last segment when the shard was split off
+} md_shard;
+
+// Cut the working list at the committed offsets cuts[0..count) into 
+// shards, stored in *shards_out. Cuts outside the document or not above
+// the previous one are skipped. Pending insertions at a cut go to the 
+// shard that starts there. The document itself must not be used until 
+// markdown_shards_join
+md_shard *markdown_shards_split(document *doc, const size_t *cuts, 
+                                size_t count, size_t *shards_out);
+
+// Relink the shards in order, fold their counters and text buffers back
+// into the document and free the array
+void markdown_shards_join(document *doc, md_shard *shards, size_t count);
+
+// === Positions ===
+// Length in bytes of the committed document
+size_t markdown_length(document *doc);
+
+size_t markdown_transform_position(const document *doc, size_t pos);
+
+// Map count positions at once, in place, in one walk of the working list.
+// Positions flagged in range_end (which may be NULL) stay before text 
+// inserted exactly at them, as the end of a range should. Positions past
+// the end of the committed document stay as far past the new end
+void markdown_transform_positions(const document *doc, size_t *positions, 
+                                  const char *range_end, size_t count);
+
+// Translate between byte and UTF-8 code-point offsets in the committed 
+// document. Both return INVALID_CURSOR_POS for offsets past the end, and
+// markdown_byte_to_cp also for a byte inside a multibyte character
+int markdown_cp_to_byte(document *doc, size_t cp, size_t *byte);
+int markdown_byte_to_cp(document *doc, size_t byte, size_t *cp);
+
+// Byte offset where a line (counted from 0) starts in the committed 
+// document, from the same index. INVALID_CURSOR_POS if the document has
+// fewer lines
+int markdown_offset_of_line(document *doc, size_t line, size_t *byte);
+
+// Copy of bytes [start, start + len) of the committed document, clamped 
+// to its end, NUL terminated, length in *out_len. Seeks through the 
+// index and copies only the segments in range. NULL if start is past the
+// end. Caller frees
+char *markdown_flatten_range(document *doc, size_t start, size_t len, 
+                             size_t *out_len);
+
+// Byte range of lines [from, to) of the committed document, lines 
+// counted from 0. to may run past the last line. INVALID_CURSOR_POS if 
+// from is past it or to < from
+int markdown_line_range(document *doc, size_t from, size_t to, 
+                        size_t *start, size_t *len);
+
 #endif // MARKDOWN_H
@@ -10,7 +10,8 @@ int authenticate_client(const char *username, char *role, int *permission);
 void execute_queued_command(const char *username, const char *command, 
                            char *result);
 void save_document_to_file(void);
-void enqueue_edit_command(const char *username, const char *command);
+void enqueue_edit_command(const char *username, const char *command, 
+                          int utf8);
 void cleanup_client_connection(int client_index);
 
 // Additional functions from server_lib.c for testing
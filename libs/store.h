@@ -0,0 +1,45 @@
+#ifndef STORE_H
+#define STORE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Durable history in an SQLite database. Each broadcast cycle is written
+ * as one transaction: a row for the version and a row per edit with its
+ * user, command and result. The document text is snapshotted every
+ * STORE_SNAPSHOT_INTERVAL versions. Every server start is a new run, so
+ * versions restarting at 1 never collide with earlier runs; queries cover
+ * the current run. Edits are indexed by version and by (username,
+ * version). All functions are thread safe.
+ */
+
+#define STORE_DEFAULT_PATH "collaborative_editor.db"
+#define STORE_SNAPSHOT_INTERVAL 100
+
+// Called once per matching edit, in version order
+typedef void (*store_edit_fn)(uint64_t version, const char *username,
+                              const char *command, const char *result,
+                              void *ctx);
+
+// Open (creating the schema if needed) and start a new run. Returns 0 on
+// success, -1 if the database cannot be used
+int store_open(const char *path);
+void store_close(void);
+int store_is_open(void);
+
+// Record one broadcast cycle: begin, any number of edits, commit
+int store_begin_batch(uint64_t version);
+int store_record_edit(const char *username, const char *command,
+                      const char *result);
+int store_commit_batch(void);
+
+// Save the document text as of version
+int store_snapshot(uint64_t version, const char *content, size_t len);
+
+// Visit edits of the current run with from <= version <= to, optionally
+// only those by username (NULL for everyone). Returns the number of
+// edits visited, or -1 on error
+long store_query_edits(const char *username, uint64_t from, uint64_t to,
+                       store_edit_fn fn, void *ctx);
+
+#endif // STORE_H
@@ -0,0 +1,57 @@
+#ifndef TEXT_SCAN_H
+#define TEXT_SCAN_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Byte scanning kernels for document text. Each kernel has scalar, SSE2
+ * and AVX2 versions; the widest one the CPU supports is picked once at
+ * startup (TEXT_SCAN_ISA=scalar|sse2|avx2 in the environment overrides
+ * it). UTF-8 helpers treat any byte that is not 10xxxxxx as the start of
+ * a code point, so malformed input is still counted consistently.
+ */
+
+#define TEXT_NPOS SIZE_MAX
+
+enum text_scan_isa {
+    TEXT_SCAN_SCALAR,
+    TEXT_SCAN_SSE2,
+    TEXT_SCAN_AVX2
+};
+
+// Kernel set in use, and a way to force one (e.g. for benchmarks).
+// Returns -1 if the CPU does not support the requested set
+int text_scan_isa(void);
+const char *text_scan_isa_name(int isa);
+int text_scan_set_isa(int isa);
+
+// Number of UTF-8 code points that start in buf
+size_t text_count_codepoints(const char *buf, size_t len);
+
+// Byte offset of the n-th code point start in buf, or len if there are
+// n or fewer
+size_t text_codepoint_offset(const char *buf, size_t len, size_t n);
+
+// 1 if byte is a UTF-8 continuation byte
+int text_is_continuation(char byte);
+
+// Offset of the first '\n' in buf, or TEXT_NPOS
+size_t text_find_newline(const char *buf, size_t len);
+
+// Offset of the last '\n' in buf[0, len), or TEXT_NPOS
+size_t text_rfind_newline(const char *buf, size_t len);
+
+// Number of '\n' bytes in buf
+size_t text_count_newlines(const char *buf, size_t len);
+
+// Length of an ordered list prefix ("<digits>. ") at the start of buf,
+// or 0 if there is none. The number is stored in *number if non-NULL
+size_t text_match_list_prefix(const char *buf, size_t len, int *number);
+
+// Adler-32 of buf continuing from adler (start with 1). Checksums of 
+// adjacent ranges combine without rereading: combine(a1, a2, len2) is 
+// the checksum of the first range followed by the second of len2 bytes
+uint32_t text_adler32(uint32_t adler, const char *buf, size_t len);
+uint32_t text_adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2);
+
+#endif // TEXT_SCAN_H
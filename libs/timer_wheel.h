@@ -0,0 +1,46 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Hierarchical timing wheel. Scheduling, rescheduling and cancelling a
+ * timer are O(1); each tick touches one slot, plus one cascade from a
+ * coarser level every TIMER_WHEEL_SLOTS ticks. Not thread safe, callers
+ * serialise access.
+ */
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 3
+
+typedef struct timer_node {
+    struct timer_node *prev;
+    struct timer_node *next;
+    uint64_t expires;      // Absolute tick at which the timer fires
+    int id;                // Caller's identifier (e.g. client slot)
+} timer_node;
+
+typedef struct {
+    timer_node slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // List heads
+    uint64_t now;          // Last tick processed
+} timer_wheel;
+
+typedef void (*timer_fn)(timer_node *node, void *ctx);
+
+void timer_wheel_init(timer_wheel *wheel, uint64_t now);
+void timer_node_init(timer_node *node, int id);
+int timer_node_pending(const timer_node *node);
+
+// Arm or re-arm node to fire at the absolute tick expires
+void timer_wheel_schedule(timer_wheel *wheel, timer_node *node,
+                          uint64_t expires);
+void timer_wheel_cancel(timer_node *node);
+
+// Process every tick up to now, calling fn for each expired timer.
+// Expired nodes are unlinked before fn runs, so fn may re-arm them.
+// Returns the number of timers fired
+size_t timer_wheel_advance(timer_wheel *wheel, uint64_t now, timer_fn fn,
+                           void *ctx);
+
+#endif // TIMER_WHEEL_H
@@ -11,11 +11,13 @@
 #include <string.h>
 #include <errno.h>
 #include "markdown.h"
+#include "lz.h"
 
 #define MAX_COMMAND_LENGTH 256
 #define MAX_USERNAME_LENGTH 128
 #define MAX_RESPONSE_LENGTH 4096
 #define HANDSHAKE_TIMEOUT_SEC 1
+#define HEARTBEAT_INTERVAL_SEC 5
 
 // Global state
 static int server_write_fd = -1;  // FIFO_C2S for writing commands to server
@@ -46,6 +48,37 @@ void setup_signal_handling(void) {
     }
 }
 
+// Periodic heartbeat so the server does not reclaim an idle session.
+// write() is async-signal-safe and the line is far below PIPE_BUF
+void heartbeat_signal_handler(int signal_number) {
+    (void)signal_number;
+    static const char heartbeat[] = "HEARTBEAT\n";
+    if (server_write_fd >= 0) {
+        ssize_t ignored = write(server_write_fd, heartbeat, 
+                                sizeof(heartbeat) - 1);
+        (void)ignored;
+    }
+}
+
+// Start sending heartbeats every HEARTBEAT_INTERVAL_SEC seconds
+void start_heartbeats(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = heartbeat_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;  // Don't interrupt fgets/read
+    if (sigaction(SIGALRM, &sa, NULL) < 0) {
+        perror("sigaction");
+        return;
+    }
+
+    struct itimerval interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.it_value.tv_sec = HEARTBEAT_INTERVAL_SEC;
+    interval.it_interval.tv_sec = HEARTBEAT_INTERVAL_SEC;
+    setitimer(ITIMER_REAL, &interval, NULL);
+}
+
 // Perform initial handshake with server
 int perform_handshake(pid_t server_pid) {
     printf("Connecting to server (PID: %d)...\n", server_pid);
@@ -168,6 +201,9 @@ int authenticate_and_download(void) {
     // Don't set document version - wait for server broadcasts
     (void)version; // Suppress unused variable warning
 
+    // Large VERSION batches arrive LZ-compressed from here on
+    dprintf(server_write_fd, "COMPRESS ON\n");
+
     printf("Connected as '%s' with '%s' permissions\n", 
            client_username, user_role);
     return 0;
@@ -178,7 +214,8 @@ void send_command(const char *command) {
     dprintf(server_write_fd, "%s\n", command);
 }
 
-// Read immediate response from server (for DOC?, PERM?, LOG? commands)
+// Read immediate response from server (for DOC?, LINES?, PERM?, LOG?, 
+// MEMSTATS?, AUDIT?)
 char* read_immediate_response(void) {
     char *response = (char *)malloc(MAX_RESPONSE_LENGTH);
     if (!response) {
@@ -195,6 +232,80 @@ char* read_immediate_response(void) {
     return response;
 }
 
+// Append one more blocking read to a growable buffer
+static ssize_t read_more(char **buf, size_t *len, size_t *cap) {
+    if (*cap - *len < MAX_RESPONSE_LENGTH) {
+        char *grown = (char *)realloc(*buf, *cap * 2);
+        if (!grown) {
+            return -1;
+        }
+        *buf = grown;
+        *cap *= 2;
+    }
+    ssize_t n = read(server_read_fd, *buf + *len, *cap - *len);
+    if (n > 0) {
+        *len += (size_t)n;
+    }
+    return n;
+}
+
+// Find the start of the next compressed frame, which always begins a line
+static size_t find_compressed_frame(const char *buf, size_t pos, size_t len) {
+    const char *marker = "\nZVERSION ";
+    size_t marker_len = strlen(marker);
+    for (size_t i = pos; i + marker_len <= len; i++) {
+        if (memcmp(buf + i, marker, marker_len) == 0) {
+            return i + 1;
+        }
+    }
+    return len;
+}
+
+// Print broadcast bytes, expanding "ZVERSION <raw_len> <len>" frames. A 
+// compressed frame split across reads is completed with blocking reads
+static void print_broadcasts(char **buf, size_t *len, size_t *cap) {
+    size_t pos = 0;
+    while (pos < *len) {
+        if (*len - pos < 9 || memcmp(*buf + pos, "ZVERSION ", 9) != 0) {
+            size_t end = find_compressed_frame(*buf, pos, *len);
+            printf("%.*s", (int)(end - pos), *buf + pos);
+            pos = end;
+            continue;
+        }
+
+        char *eol = NULL;
+        while (!(eol = memchr(*buf + pos, '\n', *len - pos))) {
+            if (read_more(buf, len, cap) <= 0) {
+                return;
+            }
+        }
+        size_t raw_len = 0;
+        size_t block_len = 0;
+        size_t header_len = (size_t)(eol - (*buf + pos)) + 1;
+        if (sscanf(*buf + pos, "ZVERSION %zu %zu", &raw_len, 
+                   &block_len) != 2) {
+            pos += header_len;
+            continue;
+        }
+        while (*len - pos < header_len + block_len) {
+            if (read_more(buf, len, cap) <= 0) {
+                return;
+            }
+        }
+
+        char *text = (char *)malloc(raw_len + 1);
+        long text_len = text ? lz_decompress(*buf + pos + header_len, 
+                                             block_len, text, raw_len) : -1;
+        if (text_len >= 0) {
+            printf("%.*s", (int)text_len, text);
+        } else {
+            fprintf(stderr, "Dropped corrupt compressed update\n");
+        }
+        free(text);
+        pos += header_len + block_len;
+    }
+}
+
 // Check for and handle server broadcasts
 void check_for_broadcasts(void) {
     fd_set read_fds;
@@ -205,18 +316,19 @@ void check_for_broadcasts(void) {
     
     if (select(server_read_fd + 1, &read_fds, NULL, NULL, &timeout) > 0) {
         if (FD_ISSET(server_read_fd, &read_fds)) {
-            char broadcast[4096];
-            ssize_t bytes_read = read(server_read_fd, broadcast, 
-                                     sizeof(broadcast) - 1);
-            if (bytes_read > 0) {
-                broadcast[bytes_read] = '\0';
-                printf("Server update:\n%s", broadcast);
+            size_t cap = MAX_RESPONSE_LENGTH;
+            size_t len = 0;
+            char *broadcast = (char *)malloc(cap);
+            if (broadcast && read_more(&broadcast, &len, &cap) > 0) {
+                printf("Server update:\n");
+                print_broadcasts(&broadcast, &len, &cap);
                 
                 // Do NOT automatically update local document state
                 // The client should only maintain local state when explicitly needed
                 // This ensures proper timing separation between command sending
                 // and document state updates
             }
+            free(broadcast);
         }
     }
 }
@@ -225,8 +337,13 @@ void check_for_broadcasts(void) {
 void process_command(const char *command) {
     // Immediate response commands - server replies immediately
     if (strcmp(command, "DOC?") == 0 || 
+        strncmp(command, "DOC? ", 5) == 0 || 
+        strncmp(command, "LINES? ", 7) == 0 || 
         strcmp(command, "PERM?") == 0 || 
-        strcmp(command, "LOG?") == 0) {
+        strcmp(command, "LOG?") == 0 || 
+        strcmp(command, "MEMSTATS?") == 0 || 
+        strcmp(command, "QSTATS?") == 0 || 
+        strncmp(command, "AUDIT?", 6) == 0) {
         
         send_command(command);
         char *response = read_immediate_response();
@@ -265,7 +382,8 @@ void run_command_loop(void) {
     printf("\nEnter commands (type 'DISCONNECT' to quit):\n");
     printf("Available commands: INSERT, DEL, NEWLINE, HEADING, BOLD, "
            "ITALIC, etc.\n");
-    printf("Query commands: DOC?, PERM?, LOG?\n\n");
+    printf("Query commands: DOC? [start len], LINES? <from> <to>, PERM?, "
+           "LOG?, MEMSTATS?, AUDIT? [user|*] [from] [to]\n\n");
     
     while (1) {
         printf("> ");
@@ -353,6 +471,9 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
+    // Keep the session alive while the user is idle
+    start_heartbeats();
+
     // Run main command loop
     run_command_loop();
 
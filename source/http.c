@@ -0,0 +1,505 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../libs/http.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define HTTP_MAX_EVENTS 64
+#define HTTP_READ_CHUNK 4096
+#define HTTP_IDLE_TIMEOUT_SEC 30
+#define HTTP_POLL_MS 1000
+#define HTTP_BACKLOG 128
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} http_buf;
+
+typedef struct http_conn {
+    int fd;
+    http_buf in;             // Bytes received, not yet parsed
+    http_buf out;            // Responses not yet written
+    size_t out_off;          // Bytes of out already written
+    int close_after;         // Close once out drains
+    time_t last_active;
+    struct http_conn *prev;
+    struct http_conn *next;
+} http_conn;
+
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static volatile int running = 0;
+static pthread_t loop_thread;
+static http_handler handler_fn = NULL;
+static void *handler_ctx = NULL;
+static http_conn *conns = NULL;   // All open connections, for idle sweeps
+
+// === Buffers ===
+
+static int buf_reserve(http_buf *buf, size_t extra) {
+    if (buf->cap - buf->len >= extra) {
+        return 0;
+    }
+    size_t cap = buf->cap ? buf->cap : HTTP_READ_CHUNK;
+    while (cap - buf->len < extra) {
+        cap *= 2;
+    }
+    char *grown = (char *)realloc(buf->data, cap);
+    if (!grown) {
+        return -1;
+    }
+    buf->data = grown;
+    buf->cap = cap;
+    return 0;
+}
+
+static void buf_append(http_buf *buf, const char *data, size_t len) {
+    if (buf_reserve(buf, len) == 0) {
+        memcpy(buf->data + buf->len, data, len);
+        buf->len += len;
+    }
+}
+
+static void buf_consume(http_buf *buf, size_t len) {
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+// === Connections ===
+
+static void close_conn(http_conn *conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        conns = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn);
+}
+
+static void accept_conns(void) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return; // EAGAIN: backlog drained
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        http_conn *conn = (http_conn *)calloc(1, sizeof(http_conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->last_active = time(NULL);
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = conns;
+        if (conns) {
+            conns->prev = conn;
+        }
+        conns = conn;
+    }
+}
+
+static const char *status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 202: return "Accepted";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 503: return "Service Unavailable";
+        default:  return "Internal Server Error";
+    }
+}
+
+/**
+ * Queue a response on the connection's output buffer
+ */
+static void queue_response(http_conn *conn, int status, const char *type,
+                           const char *body, size_t body_len) {
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Connection: %s\r\n\r\n",
+                     status, status_text(status), type, body_len,
+                     conn->close_after ? "close" : "keep-alive");
+    buf_append(&conn->out, head, (size_t)n);
+    buf_append(&conn->out, body, body_len);
+}
+
+static void queue_error(http_conn *conn, int status) {
+    char body[64];
+    int n = snprintf(body, sizeof(body), "{\"error\":\"%s\"}",
+                     status_text(status));
+    conn->close_after = 1;
+    queue_response(conn, status, "application/json", body, (size_t)n);
+}
+
+/**
+ * Find a header's value in the header block. Returns its length, or -1
+ */
+static long find_header(const char *head, size_t head_len, const char *name,
+                        const char **value) {
+    size_t name_len = strlen(name);
+    const char *end = head + head_len;
+    const char *line = memchr(head, '\n', head_len);   // Skip request line
+    while (line && line + 1 < end) {
+        line++;
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) {
+            break;
+        }
+        if ((size_t)(eol - line) > name_len && line[name_len] == ':' &&
+            strncasecmp(line, name, name_len) == 0) {
+            const char *v = line + name_len + 1;
+            while (v < eol && (*v == ' ' || *v == '\t')) {
+                v++;
+            }
+            const char *vend = eol;
+            while (vend > v && (vend[-1] == '\r' || vend[-1] == ' ')) {
+                vend--;
+            }
+            *value = v;
+            return (long)(vend - v);
+        }
+        line = eol;
+    }
+    return -1;
+}
+
+/**
+ * Parse and answer every complete request in the input buffer. Returns
+ * -1 if the connection should be dropped without a reply
+ */
+static int process_requests(http_conn *conn) {
+    while (!conn->close_after) {
+        char *head_end = NULL;
+        if (conn->in.len >= 4) {
+            for (size_t i = 0; i + 3 < conn->in.len; i++) {
+                if (memcmp(conn->in.data + i, "\r\n\r\n", 4) == 0) {
+                    head_end = conn->in.data + i + 4;
+                    break;
+                }
+            }
+        }
+        if (!head_end) {
+            if (conn->in.len > HTTP_MAX_HEADER_LEN) {
+                queue_error(conn, 413);
+            }
+            return 0; // Wait for more bytes
+        }
+        size_t head_len = (size_t)(head_end - conn->in.data);
+
+        // Request line: METHOD SP TARGET SP VERSION
+        char method[16];
+        char target[2048];
+        char version[16];
+        char line[2100];
+        const char *eol = memchr(conn->in.data, '\n', head_len);
+        size_t line_len = (size_t)(eol - conn->in.data);
+        if (line_len >= sizeof(line)) {
+            queue_error(conn, 400);
+            return 0;
+        }
+        memcpy(line, conn->in.data, line_len);
+        line[line_len] = '\0';
+        if (sscanf(line, "%15s %2047s %15s", method, target, version) != 3) {
+            queue_error(conn, 400);
+            return 0;
+        }
+
+        const char *value = NULL;
+        long vlen = find_header(conn->in.data, head_len, "Content-Length",
+                                &value);
+        size_t body_len = (vlen > 0) ? (size_t)strtoull(value, NULL, 10) : 0;
+        if (find_header(conn->in.data, head_len, "Transfer-Encoding",
+                        &value) >= 0) {
+            queue_error(conn, 400); // Chunked bodies are not accepted
+            return 0;
+        }
+        if (body_len > HTTP_MAX_BODY_LEN) {
+            queue_error(conn, 413);
+            return 0;
+        }
+        if (conn->in.len < head_len + body_len) {
+            return 0; // Body still arriving
+        }
+
+        // HTTP/1.1 stays open unless asked otherwise; 1.0 must opt in
+        vlen = find_header(conn->in.data, head_len, "Connection", &value);
+        int keep_alive = (strcmp(version, "HTTP/1.1") == 0);
+        if (vlen == 5 && strncasecmp(value, "close", 5) == 0) {
+            keep_alive = 0;
+        } else if (vlen == 10 && strncasecmp(value, "keep-alive", 10) == 0) {
+            keep_alive = 1;
+        }
+
+        char *query = strchr(target, '?');
+        if (query) {
+            *query++ = '\0';
+        }
+
+        // The body is handed over NUL terminated
+        char *body = (char *)malloc(body_len + 1);
+        if (!body) {
+            return -1;
+        }
+        memcpy(body, conn->in.data + head_len, body_len);
+        body[body_len] = '\0';
+        buf_consume(&conn->in, head_len + body_len);
+
+        http_request req = {method, target, query ? query : "", body,
+                            body_len};
+        http_response resp = {404, "application/json", NULL, 0};
+        handler_fn(&req, &resp, handler_ctx);
+        free(body);
+
+        conn->close_after = !keep_alive;
+        queue_response(conn, resp.status, resp.content_type,
+                       resp.body ? resp.body : "", resp.body_len);
+        free(resp.body);
+    }
+    return 0;
+}
+
+/**
+ * Write as much pending output as the socket takes. Returns -1 once the
+ * connection should be closed
+ */
+static int flush_output(http_conn *conn) {
+    while (conn->out_off < conn->out.len) {
+        ssize_t n = write(conn->fd, conn->out.data + conn->out_off,
+                          conn->out.len - conn->out_off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        conn->out_off += (size_t)n;
+    }
+
+    int pending = conn->out_off < conn->out.len;
+    if (!pending) {
+        conn->out.len = 0;
+        conn->out_off = 0;
+        if (conn->close_after) {
+            return -1;
+        }
+    }
+
+    // Only wait for writability while output is queued
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | (pending ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    return 0;
+}
+
+static void handle_readable(http_conn *conn) {
+    for (;;) {
+        if (buf_reserve(&conn->in, HTTP_READ_CHUNK) < 0) {
+            close_conn(conn);
+            return;
+        }
+        ssize_t n = read(conn->fd, conn->in.data + conn->in.len,
+                         conn->in.cap - conn->in.len);
+        if (n > 0) {
+            conn->in.len += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // Peer closed; answer what already arrived, then close
+        conn->close_after = 1;
+        break;
+    }
+
+    int peer_closed = conn->close_after;
+    conn->close_after = 0;
+    if (process_requests(conn) < 0) {
+        close_conn(conn);
+        return;
+    }
+    conn->close_after |= peer_closed;
+    if (flush_output(conn) < 0) {
+        close_conn(conn);
+    }
+}
+
+/**
+ * Close connections that have been silent too long
+ */
+static void sweep_idle(void) {
+    time_t now = time(NULL);
+    http_conn *conn = conns;
+    while (conn) {
+        http_conn *next = conn->next;
+        if (now - conn->last_active > HTTP_IDLE_TIMEOUT_SEC) {
+            close_conn(conn);
+        }
+        conn = next;
+    }
+}
+
+static void *http_loop(void *arg) {
+    (void)arg;
+    struct epoll_event events[HTTP_MAX_EVENTS];
+    time_t last_sweep = time(NULL);
+
+    while (running) {
+        int n = epoll_wait(epoll_fd, events, HTTP_MAX_EVENTS, HTTP_POLL_MS);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_conns();
+                continue;
+            }
+            http_conn *conn = (http_conn *)events[i].data.ptr;
+            conn->last_active = time(NULL);
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                handle_readable(conn);
+            } else if (events[i].events & EPOLLOUT) {
+                if (flush_output(conn) < 0) {
+                    close_conn(conn);
+                }
+            } else if (events[i].events & EPOLLERR) {
+                close_conn(conn);
+            }
+        }
+        if (time(NULL) != last_sweep) {
+            sweep_idle();
+            last_sweep = time(NULL);
+        }
+    }
+
+    while (conns) {
+        close_conn(conns);
+    }
+    return NULL;
+}
+
+// === Public API ===
+
+int http_server_start(const char *addr, int port, http_handler handler,
+                      void *ctx) {
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons((unsigned short)port);
+    if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+        return -1;
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+        listen(listen_fd, HTTP_BACKLOG) < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(0);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;   // NULL marks the listening socket
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd,
+                                  &ev) < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    handler_fn = handler;
+    handler_ctx = ctx;
+    running = 1;
+    if (pthread_create(&loop_thread, NULL, http_loop, NULL) != 0) {
+        running = 0;
+        close(epoll_fd);
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void http_server_stop(void) {
+    if (!running) {
+        return;
+    }
+    running = 0;
+    pthread_join(loop_thread, NULL);
+    close(epoll_fd);
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+int http_query_param(const char *query, const char *name, char *out,
+                     size_t cap) {
+    size_t name_len = strlen(name);
+    const char *p = query;
+    while (p && *p) {
+        const char *amp = strchr(p, '&');
+        size_t len = amp ? (size_t)(amp - p) : strlen(p);
+        if (len > name_len && p[name_len] == '=' &&
+            strncmp(p, name, name_len) == 0) {
+            size_t vlen = len - name_len - 1;
+            if (vlen >= cap) {
+                vlen = cap - 1;
+            }
+            memcpy(out, p + name_len + 1, vlen);
+            out[vlen] = '\0';
+            return 0;
+        }
+        p = amp ? amp + 1 : NULL;
+    }
+    return -1;
+}
@@ -0,0 +1,354 @@
+#define _DEFAULT_SOURCE  // For syscall and MAP_POPULATE
+#include "../libs/io_backend.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#define URING_ENTRIES 128
+
+static int backend = IO_BACKEND_WRITE;
+static pthread_mutex_t backend_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// === Plain write(2) path ===
+
+/**
+ * Write a buffer completely with blocking writes, retrying on EINTR
+ */
+static ssize_t write_fully(int fd, const char *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, buf + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return done > 0 ? (ssize_t)done : -1;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+#ifdef HAVE_IO_URING
+
+// === io_uring path (raw syscalls, no liburing) ===
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    int cur_pos_writes;   // Kernel accepts offset -1 for file writes
+} uring_t;
+
+static uring_t ring;
+
+/**
+ * Create the ring and map its submission and completion queues
+ */
+static int uring_setup(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = fd;
+    ring.entries = params.sq_entries;
+    ring.cur_pos_writes = (params.features & IORING_FEAT_RW_CUR_POS) != 0;
+    ring.sq_ring_size = params.sq_off.array +
+                        params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes +
+                        params.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring.cq_ring == MAP_FAILED) {
+        munmap(ring.sq_ring, ring.sq_ring_size);
+        close(fd);
+        return -1;
+    }
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        munmap(ring.sq_ring, ring.sq_ring_size);
+        munmap(ring.cq_ring, ring.cq_ring_size);
+        close(fd);
+        return -1;
+    }
+
+    char *sq = (char *)ring.sq_ring;
+    char *cq = (char *)ring.cq_ring;
+    ring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_teardown(void) {
+    munmap(ring.sqes, ring.sqes_size);
+    munmap(ring.cq_ring, ring.cq_ring_size);
+    munmap(ring.sq_ring, ring.sq_ring_size);
+    close(ring.fd);
+}
+
+/**
+ * Queue one write SQE. user_data carries the caller's index
+ */
+static void uring_queue_write(int fd, const void *buf, size_t len,
+                              uint64_t offset, uint64_t user_data) {
+    unsigned tail = *ring.sq_tail;
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (unsigned)len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring.sq_array[index] = index;
+
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Collect every CQE already posted into res and mark it in seen, both
+ * indexed by user_data. Returns how many were collected
+ */
+static unsigned uring_reap(int *res, char *seen) {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    unsigned reaped = 0;
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        res[cqe->user_data] = cqe->res;
+        seen[cqe->user_data] = 1;
+        head++;
+        reaped++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+/**
+ * Submit count queued SQEs and collect all their results into res,
+ * indexed by user_data; seen marks the ones whose CQE arrived. Returns 
+ * -1 if the ring failed, after collecting whatever had completed. The 
+ * ring must then be dropped (uring_fail): it may still hold entries
+ */
+static int uring_submit_and_wait(unsigned count, int *res, char *seen) {
+    memset(seen, 0, count);
+    unsigned submitted = 0;
+    while (submitted < count) {
+        int n = (int)syscall(__NR_io_uring_enter, ring.fd,
+                             count - submitted, 0, 0, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            uring_reap(res, seen);
+            return -1;
+        }
+        submitted += (unsigned)n;
+    }
+
+    unsigned reaped = 0;
+    while (reaped < count) {
+        unsigned got = uring_reap(res, seen);
+        if (got > 0) {
+            reaped += got;
+            continue;
+        }
+        int n = (int)syscall(__NR_io_uring_enter, ring.fd, 0, 1,
+                             IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0 && errno != EINTR) {
+            uring_reap(res, seen);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Drop a ring that failed, so no stale entry is read back by a later 
+ * call, and use plain writes from now on. Caller holds backend_mutex
+ */
+static void uring_fail(void) {
+    uring_teardown();
+    __atomic_store_n(&backend, IO_BACKEND_WRITE, __ATOMIC_RELAXED);
+}
+
+#endif // HAVE_IO_URING
+
+// === Public API ===
+
+/**
+ * Probe for io_uring and fall back to plain writes if it is missing,
+ * disabled, or blocked by a seccomp policy
+ */
+int io_backend_init(int allow_uring) {
+    backend = IO_BACKEND_WRITE;
+#ifdef HAVE_IO_URING
+    if (allow_uring && uring_setup() == 0) {
+        backend = IO_BACKEND_URING;
+    }
+#else
+    (void)allow_uring;
+#endif
+    return backend;
+}
+
+void io_backend_shutdown(void) {
+    pthread_mutex_lock(&backend_mutex);
+#ifdef HAVE_IO_URING
+    if (backend == IO_BACKEND_URING) {
+        uring_teardown();
+    }
+#endif
+    backend = IO_BACKEND_WRITE;
+    pthread_mutex_unlock(&backend_mutex);
+}
+
+const char *io_backend_name(void) {
+    return __atomic_load_n(&backend, __ATOMIC_RELAXED) == IO_BACKEND_URING 
+         ? "io_uring" : "write";
+}
+
+/**
+ * Broadcast one buffer to many pipes. With io_uring the whole fan-out is
+ * one submission per ring-full of clients; a short write to a full pipe
+ * is finished with a blocking write so no client sees a partial message.
+ * If the ring fails, only the writes it gave no result for are redone
+ */
+void io_backend_fanout(const int *fds, size_t count, const void *buf,
+                       size_t len) {
+    if (count == 0 || len == 0) {
+        return;
+    }
+
+#ifdef HAVE_IO_URING
+    pthread_mutex_lock(&backend_mutex);
+    if (backend == IO_BACKEND_URING) {
+        int res[URING_ENTRIES];
+        char seen[URING_ENTRIES];
+        size_t done = 0;
+        while (done < count) {
+            unsigned batch = (unsigned)(count - done);
+            if (batch > ring.entries) {
+                batch = ring.entries;
+            }
+            for (unsigned i = 0; i < batch; i++) {
+                uring_queue_write(fds[done + i], buf, len, (uint64_t)-1, i);
+            }
+            int failed = (uring_submit_and_wait(batch, res, seen) < 0);
+            for (unsigned i = 0; i < batch; i++) {
+                if (!seen[i]) {
+                    write_fully(fds[done + i], (const char *)buf, len);
+                } else if (res[i] >= 0 && (size_t)res[i] < len) {
+                    write_fully(fds[done + i], (const char *)buf + res[i],
+                                len - (size_t)res[i]);
+                }
+            }
+            done += batch;
+            if (failed) {
+                uring_fail();
+                break;
+            }
+        }
+        pthread_mutex_unlock(&backend_mutex);
+        if (done == count) {
+            return;
+        }
+        fds += done;
+        count -= done;
+    } else {
+        pthread_mutex_unlock(&backend_mutex);
+    }
+#endif
+
+    for (size_t i = 0; i < count; i++) {
+        write_fully(fds[i], (const char *)buf, len);
+    }
+}
+
+/**
+ * Write a persistence buffer (doc.md, logs) at the file's current
+ * position, through the ring when available
+ */
+ssize_t io_backend_write_all(int fd, const void *buf, size_t len) {
+#ifdef HAVE_IO_URING
+    pthread_mutex_lock(&backend_mutex);
+    if (backend == IO_BACKEND_URING && ring.cur_pos_writes) {
+        size_t done = 0;
+        while (done < len) {
+            int res = 0;
+            char seen = 0;
+            uring_queue_write(fd, (const char *)buf + done, len - done,
+                              (uint64_t)-1, 0);
+            if (uring_submit_and_wait(1, &res, &seen) < 0) {
+                if (seen && res > 0) {
+                    done += (size_t)res;
+                }
+                uring_fail();
+                break;
+            }
+            if (res <= 0) {
+                break;
+            }
+            done += (size_t)res;
+        }
+        pthread_mutex_unlock(&backend_mutex);
+        if (done == len) {
+            return (ssize_t)done;
+        }
+        ssize_t rest = write_fully(fd, (const char *)buf + done, len - done);
+        return rest < 0 ? -1 : (ssize_t)(done + (size_t)rest);
+    }
+    pthread_mutex_unlock(&backend_mutex);
+#endif
+    return write_fully(fd, (const char *)buf, len);
+}
@@ -0,0 +1,340 @@
+#include "../libs/json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_INITIAL_CAP 256
+#define JSON_MAX_KEY_LEN 64
+
+// === Writer helpers ===
+
+static void put(json_writer *w, const char *s, size_t n) {
+    if (w->cap - w->len < n + 1) {
+        size_t cap = w->cap ? w->cap : JSON_INITIAL_CAP;
+        while (cap - w->len < n + 1) {
+            cap *= 2;
+        }
+        char *grown = (char *)realloc(w->data, cap);
+        if (!grown) {
+            return;
+        }
+        w->data = grown;
+        w->cap = cap;
+    }
+    memcpy(w->data + w->len, s, n);
+    w->len += n;
+    w->data[w->len] = '\0';
+}
+
+static void put_char(json_writer *w, char c) {
+    put(w, &c, 1);
+}
+
+/**
+ * Emit the separator a new member or element needs, and record that the
+ * enclosing container is no longer empty
+ */
+static void begin_value(json_writer *w) {
+    if (w->after_key) {
+        w->after_key = 0;
+        return;
+    }
+    if (w->depth > 0 && w->depth <= JSON_MAX_DEPTH) {
+        if (w->has_items[w->depth - 1]) {
+            put_char(w, ',');
+        }
+        w->has_items[w->depth - 1] = 1;
+    }
+}
+
+static void open_container(json_writer *w, char c) {
+    begin_value(w);
+    put_char(w, c);
+    if (w->depth < JSON_MAX_DEPTH) {
+        w->has_items[w->depth] = 0;
+    }
+    w->depth++;
+}
+
+static void close_container(json_writer *w, char c) {
+    if (w->depth > 0) {
+        w->depth--;
+    }
+    put_char(w, c);
+}
+
+// === Writer ===
+
+void json_init(json_writer *w) {
+    memset(w, 0, sizeof(*w));
+}
+
+void json_free(json_writer *w) {
+    free(w->data);
+    json_init(w);
+}
+
+char *json_release(json_writer *w, size_t *len) {
+    char *data = w->data;
+    *len = w->len;
+    json_init(w);
+    return data;
+}
+
+void json_object_begin(json_writer *w) {
+    open_container(w, '{');
+}
+
+void json_object_end(json_writer *w) {
+    close_container(w, '}');
+}
+
+void json_array_begin(json_writer *w) {
+    open_container(w, '[');
+}
+
+void json_array_end(json_writer *w) {
+    close_container(w, ']');
+}
+
+void json_key(json_writer *w, const char *key) {
+    json_string(w, key);
+    put_char(w, ':');
+    w->after_key = 1;
+}
+
+void json_string(json_writer *w, const char *s) {
+    json_string_len(w, s, strlen(s));
+}
+
+/**
+ * Write a quoted string, copying runs of plain bytes in one go and
+ * escaping quotes, backslashes and control characters
+ */
+void json_string_len(json_writer *w, const char *s, size_t len) {
+    begin_value(w);
+    put_char(w, '"');
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        put(w, s + run, i - run);
+        run = i + 1;
+
+        char esc[8];
+        switch (c) {
+            case '"':  put(w, "\\\"", 2); break;
+            case '\\': put(w, "\\\\", 2); break;
+            case '\n': put(w, "\\n", 2); break;
+            case '\r': put(w, "\\r", 2); break;
+            case '\t': put(w, "\\t", 2); break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                put(w, esc, 6);
+                break;
+        }
+    }
+    put(w, s + run, len - run);
+    put_char(w, '"');
+}
+
+void json_uint(json_writer *w, uint64_t v) {
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%llu", (unsigned long long)v);
+    begin_value(w);
+    put(w, num, (size_t)n);
+}
+
+void json_double(json_writer *w, double v) {
+    char num[32];
+    int n = snprintf(num, sizeof(num), "%.6g", v);
+    begin_value(w);
+    put(w, num, (size_t)n);
+}
+
+void json_bool(json_writer *w, int v) {
+    begin_value(w);
+    put(w, v ? "true" : "false", v ? 4 : 5);
+}
+
+// === Reader ===
+
+static void skip_ws(const char *json, size_t len, size_t *i) {
+    while (*i < len && (json[*i] == ' ' || json[*i] == '\t' ||
+                        json[*i] == '\n' || json[*i] == '\r')) {
+        (*i)++;
+    }
+}
+
+static int hex4(const char *p, unsigned *out) {
+    unsigned v = 0;
+    for (int k = 0; k < 4; k++) {
+        char c = p[k];
+        v <<= 4;
+        if (c >= '0' && c <= '9') {
+            v |= (unsigned)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            v |= (unsigned)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            v |= (unsigned)(c - 'A' + 10);
+        } else {
+            return -1;
+        }
+    }
+    *out = v;
+    return 0;
+}
+
+static size_t encode_utf8(unsigned cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/**
+ * Parse the string starting at json[*i] (the opening quote) and decode
+ * it into out, NUL terminated. With out NULL the string is only skipped.
+ * Returns -1 on a syntax error, -2 if it does not fit in cap
+ */
+static int parse_string(const char *json, size_t len, size_t *i,
+                        char *out, size_t cap) {
+    if (*i >= len || json[*i] != '"') {
+        return -1;
+    }
+    (*i)++;
+    size_t n = 0;
+    int overflow = 0;
+    while (*i < len && json[*i] != '"') {
+        char buf[4];
+        size_t blen = 1;
+        buf[0] = json[*i];
+        if (json[*i] == '\\') {
+            if (*i + 1 >= len) {
+                return -1;
+            }
+            char e = json[*i + 1];
+            *i += 2;
+            unsigned cp = 0;
+            switch (e) {
+                case '"': case '\\': case '/': buf[0] = e; break;
+                case 'b': buf[0] = '\b'; break;
+                case 'f': buf[0] = '\f'; break;
+                case 'n': buf[0] = '\n'; break;
+                case 'r': buf[0] = '\r'; break;
+                case 't': buf[0] = '\t'; break;
+                case 'u':
+                    if (*i + 4 > len || hex4(json + *i, &cp) < 0) {
+                        return -1;
+                    }
+                    *i += 4;
+                    // Combine a surrogate pair into one code point
+                    if (cp >= 0xD800 && cp < 0xDC00 && *i + 6 <= len &&
+                        json[*i] == '\\' && json[*i + 1] == 'u') {
+                        unsigned lo = 0;
+                        if (hex4(json + *i + 2, &lo) == 0 &&
+                            lo >= 0xDC00 && lo < 0xE000) {
+                            cp = 0x10000 + ((cp - 0xD800) << 10) +
+                                 (lo - 0xDC00);
+                            *i += 6;
+                        }
+                    }
+                    blen = encode_utf8(cp, buf);
+                    break;
+                default:
+                    return -1;
+            }
+        } else {
+            (*i)++;
+        }
+        if (out) {
+            if (n + blen >= cap) {
+                overflow = 1;
+            } else {
+                memcpy(out + n, buf, blen);
+                n += blen;
+            }
+        }
+    }
+    if (*i >= len) {
+        return -1; // Unterminated
+    }
+    (*i)++;
+    if (out) {
+        out[n] = '\0';
+    }
+    return overflow ? -2 : 0;
+}
+
+int json_get_string(const char *json, size_t len, const char *key,
+                    char *out, size_t cap) {
+    size_t i = 0;
+    skip_ws(json, len, &i);
+    if (i >= len || json[i] != '{') {
+        return -1;
+    }
+    i++;
+    skip_ws(json, len, &i);
+
+    while (i < len && json[i] != '}') {
+        char name[JSON_MAX_KEY_LEN];
+        int named = parse_string(json, len, &i, name, sizeof(name));
+        if (named == -1) {
+            return -1;
+        }
+        skip_ws(json, len, &i);
+        if (i >= len || json[i] != ':') {
+            return -1;
+        }
+        i++;
+        skip_ws(json, len, &i);
+        if (i >= len) {
+            return -1;
+        }
+
+        int match = (named == 0 && strcmp(name, key) == 0);
+        if (json[i] == '"') {
+            if (match) {
+                return parse_string(json, len, &i, out, cap) == 0 ? 0 : -1;
+            }
+            if (parse_string(json, len, &i, NULL, 0) < 0) {
+                return -1;
+            }
+        } else if (json[i] == '{' || json[i] == '[' || match) {
+            return -1; // Nested values are not supported; key not a string
+        } else {
+            // Number, true, false or null
+            while (i < len && json[i] != ',' && json[i] != '}' &&
+                   json[i] != ' ' && json[i] != '\n') {
+                i++;
+            }
+        }
+
+        skip_ws(json, len, &i);
+        if (i < len && json[i] == ',') {
+            i++;
+            skip_ws(json, len, &i);
+        } else if (i >= len || json[i] != '}') {
+            return -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,187 @@
+#include "../libs/lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+// === Helper Functions ===
+
+static uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Write the extension bytes for a length whose nibble was saturated
+ */
+static int put_length(char *dst, size_t cap, size_t *op, size_t n) {
+    while (n >= 255) {
+        if (*op >= cap) {
+            return -1;
+        }
+        dst[(*op)++] = (char)255;
+        n -= 255;
+    }
+    if (*op >= cap) {
+        return -1;
+    }
+    dst[(*op)++] = (char)n;
+    return 0;
+}
+
+/**
+ * Emit one sequence: literals, then a match unless match_len is 0
+ */
+static int put_sequence(char *dst, size_t cap, size_t *op,
+                        const char *lit, size_t lit_len,
+                        size_t offset, size_t match_len) {
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    unsigned char token = (unsigned char)(((lit_len >= 15 ? 15 : lit_len)
+                                           << 4) | (ml >= 15 ? 15 : ml));
+    if (*op >= cap) {
+        return -1;
+    }
+    dst[(*op)++] = (char)token;
+    if (lit_len >= 15 && put_length(dst, cap, op, lit_len - 15) < 0) {
+        return -1;
+    }
+    if (cap - *op < lit_len) {
+        return -1;
+    }
+    memcpy(dst + *op, lit, lit_len);
+    *op += lit_len;
+
+    if (match_len == 0) {
+        return 0;
+    }
+    if (cap - *op < 2) {
+        return -1;
+    }
+    dst[(*op)++] = (char)(offset & 0xff);
+    dst[(*op)++] = (char)(offset >> 8);
+    if (ml >= 15 && put_length(dst, cap, op, ml - 15) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read a saturated length's extension bytes
+ */
+static int get_length(const unsigned char *src, size_t len, size_t *ip,
+                      size_t *n) {
+    unsigned char b;
+    do {
+        if (*ip >= len) {
+            return -1;
+        }
+        b = src[(*ip)++];
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+// === Public API ===
+
+size_t lz_compress_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+/**
+ * Greedy single-pass compressor with a 4 KB-entry hash of 4-byte prefixes
+ */
+size_t lz_compress(const char *src, size_t len, char *dst, size_t cap) {
+    uint32_t table[LZ_HASH_SIZE];   // Position + 1, 0 = empty
+    memset(table, 0, sizeof(table));
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = hash32(seq);
+        size_t cand = table[h];
+        table[h] = (uint32_t)(ip + 1);
+
+        if (cand == 0 || ip - (cand - 1) > LZ_MAX_OFFSET ||
+            read32(src + cand - 1) != seq) {
+            ip++;
+            continue;
+        }
+
+        // Extend the match as far as it goes
+        size_t ref = cand - 1;
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len &&
+               src[ref + match_len] == src[ip + match_len]) {
+            match_len++;
+        }
+
+        if (put_sequence(dst, cap, &op, src + anchor, ip - anchor,
+                         ip - ref, match_len) < 0) {
+            return 0;
+        }
+        ip += match_len;
+        anchor = ip;
+    }
+
+    // Trailing literals close the block
+    if (put_sequence(dst, cap, &op, src + anchor, len - anchor, 0, 0) < 0) {
+        return 0;
+    }
+    return op;
+}
+
+/**
+ * Bounds-checked decoder; overlapping matches are copied byte by byte
+ */
+long lz_decompress(const char *src, size_t len, char *dst, size_t cap) {
+    const unsigned char *in = (const unsigned char *)src;
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < len) {
+        unsigned char token = in[ip++];
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && get_length(in, len, &ip, &lit_len) < 0) {
+            return -1;
+        }
+        if (len - ip < lit_len || cap - op < lit_len) {
+            return -1;
+        }
+        memcpy(dst + op, in + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == len) {
+            break; // Final literal-only sequence
+        }
+
+        if (len - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)in[ip] | ((size_t)in[ip + 1] << 8);
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && get_length(in, len, &ip, &match_len) < 0) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || cap - op < match_len) {
+            return -1;
+        }
+        for (size_t i = 0; i < match_len; i++) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += match_len;
+    }
+    return (long)op;
+}
@@ -1,22 +1,167 @@
+#define _POSIX_C_SOURCE 200809L  // For sysconf
 #include "../libs/markdown.h"
 #include "../libs/document.h"  // path depends on your folder structure
+#include "../libs/text_scan.h"
 #include <stdlib.h> 
 #include <string.h> 
-#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define SUCCESS 0
+#define POS_INDEX_CHUNK 256
+#define TEXT_BLOCK_MIN 256
+#define TEXT_BLOCK_MAX (64 * 1024)
+#define COMPACT_MIN_DEAD_BYTES (64 * 1024)
+#define FLATTEN_PARALLEL_MIN (8u << 20)    // Smaller documents copy inline
+#define FLATTEN_WORKER_MIN (4u << 20)      // Bytes per extra worker
+#define FLATTEN_MAX_WORKERS 16
+#define FLATTEN_BLOCK (64 * 1024)          // Checksummed while in cache
+
+// One block of a text buffer. Blocks never move or change once written,
+// so segments can point straight into them
+struct text_block {
+    struct text_block *next;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+
+// Code points and newlines in a stretch of text, by POS_INDEX_CHUNK-byte
+// piece: cps[k] and lines[k] count what lies before byte 
+// k * POS_INDEX_CHUNK. Text never changes once written, so every segment
+// cut from the stretch shares the table, across versions, and the last 
+// one to go frees it
+typedef struct {
+    size_t refs;
+    size_t len;
+    size_t count;          // Pieces
+    size_t *cps;           // count + 1 prefix counts
+    size_t *lines;
+} count_table;
+
+// One committed segment in the position index. Its text starts at 
+// table_off in table coordinates
+typedef struct {
+    const text_segment *seg;
+    size_t byte_start;     // Document byte offset of the segment
+    size_t cp_start;       // Code points that start before the segment
+    size_t line_start;     // Newlines before the segment
+    count_table *table;
+    size_t table_off;
+    size_t table_cps;      // Table counts before table_off
+    size_t table_lines;
+} pos_run;
+
+// What find_run searches the runs by
+enum chunk_key {
+    KEY_BYTE,
+    KEY_CP,
+    KEY_LINE
+};
+
+// What one working-list change did, enough to reverse it
+enum undo_kind {
+    UNDO_SPLIT,            // seg was cut at len, its tail linked after it
+    UNDO_LINK,             // seg..last were linked in after prev
+    UNDO_STATE             // seg left state
+};
+
+typedef struct {
+    enum undo_kind kind;
+    text_segment *seg;
+    text_segment *prev;
+    text_segment *last;
+    size_t len;
+    enum seg_state state;
+} undo_entry;
+
+// Changes since markdown_savepoint, undone newest first
+struct md_undo {
+    undo_entry *entries;
+    size_t count;
+    size_t cap;
+    int was_empty;         // No working list at the savepoint
+};
+
+// The committed segments in order, for O(log n) position translation
+struct pos_index {
+    pos_run *runs;
+    size_t count;
+    size_t cap;
+    size_t bytes;          // Committed document length in bytes
+    size_t cps;            // Committed document length in code points
+    size_t lines;          // Newlines in the committed document
+    size_t table_bytes;    // Memory held by the count tables
+};
 
 // === Forward Declarations for Internal Helper Functions ===
 static int validate_version_op(document *doc, uint64_t version);
 static int validate_range_op(document *doc, uint64_t version, 
                             size_t start, size_t end);
-static char get_char_at_pos(const char *flat, size_t flat_len, size_t pos);
-static int needs_newline_before(const char *flat, size_t pos);
+static char get_char_at_pos(document *doc, size_t pos);
+static int needs_newline_before(document *doc, size_t pos);
 static int insert_block_element(document *doc, size_t pos, 
                                const char *marker);
 static int apply_range_format(document *doc, size_t start, size_t end, 
                              const char *marker);
-static void free_segment_list(text_segment *head);
+static void free_segment_list(document *doc, text_segment *head, 
+                              int working);
+static text_segment *segment_new(document *doc, const char *content, 
+                                 size_t len, enum seg_state state);
+static const char *buffer_append(document *doc, const char *text, 
+                                 size_t len);
+static void free_blocks(document *doc, struct text_block *block);
+static void compact_buffers(document *doc);
+static void segment_free(document *doc, text_segment *seg, int working);
+static void segment_truncate(document *doc, text_segment *seg, size_t len);
+static void segment_set_state(document *doc, text_segment *seg, 
+                              enum seg_state state);
+static void free_pos_index(document *doc, struct pos_index *index, 
+                           size_t *table_bytes);
+static void record_undo(document *doc, enum undo_kind kind, 
+                        text_segment *seg, text_segment *prev, 
+                        text_segment *last, size_t len);
+static void free_undo(document *doc);
+static struct pos_index *get_pos_index(document *doc);
+static struct pos_index *patch_pos_index(document *doc);
+static const pos_run *find_run(const struct pos_index *index, size_t key, 
+                               enum chunk_key by);
+static const text_segment *index_seek(document *doc, size_t pos, 
+                                      size_t *off);
+static void run_counts_at(const pos_run *run, size_t off, size_t *cps, 
+                          size_t *lines);
+static size_t run_scan_start(const pos_run *run, size_t target, 
+                             enum chunk_key by, size_t *base);
+static int check_boundary(document *doc, size_t pos);
+static char *flatten_committed(const document *doc, size_t *out_len, 
+                               uint32_t *adler);
+static int validate_position_op(document *doc, uint64_t version, 
+                               size_t pos);
+static void clear_finger(document *doc);
+static void set_finger(document *doc, text_segment *prev, text_segment *seg, 
+                       size_t seen);
+static void walk_start(document *doc, size_t pos, int before_inserts, 
+                       text_segment **prev, text_segment **cur, 
+                       size_t *seen);
+static text_segment *split_segment(document *doc, text_segment *cur, 
+                                   size_t off);
+static const char *store_text(document *doc, const char *str, size_t len);
+static void link_insertion(document *doc, text_segment *prev, 
+                           text_segment *cur, size_t seen, const char *text,
+                           size_t len);
+static void link_chain(document *doc, text_segment *prev, text_segment *cur,
+                       size_t seen, text_segment *first, text_segment *last);
+static int put_stored(document *doc, size_t pos, const char *text, 
+                      size_t len);
+static void put_chain(document *doc, size_t pos, text_segment *first, 
+                      text_segment *last);
+static int copy_range(document *doc, size_t start, size_t len, size_t dest);
+static size_t sort_positions(const size_t *positions, size_t count, 
+                             size_t **out);
+static int match_at(const text_segment *n, size_t off, const char *needle, 
+                    size_t len);
+static size_t find_matches(document *doc, const char *needle, size_t len, 
+                           size_t **out);
 
 // Document manipulation functions (internal)
 int add_text(document *doc, size_t pos, const char *text);
@@ -53,26 +198,46 @@ static int validate_range_op(document *doc, uint64_t version,
     if (end <= start) {
         return INVALID_CURSOR_POS;
     }
+    if (check_boundary(doc, start) != SUCCESS || 
+        check_boundary(doc, end) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
     return SUCCESS;
 }
 
 /**
- * Get character at position in flattened document, returns 0 if out of bounds
+ * Standard validation for single-position operations
+ */
+static int validate_position_op(document *doc, uint64_t version, 
+                               size_t pos) {
+    int result = validate_version_op(doc, version);
+    if (result != SUCCESS) {
+        return result;
+    }
+    return check_boundary(doc, pos);
+}
+
+/**
+ * Get character at position in the committed document, returns 0 if out 
+ * of bounds. Looked up through the position index, no flattening
  */
-static char get_char_at_pos(const char *flat, size_t flat_len, size_t pos) {
-    return (pos < flat_len) ? flat[pos] : 0;
+static char get_char_at_pos(document *doc, size_t pos) {
+    struct pos_index *index = get_pos_index(doc);
+    if (pos >= index->bytes) {
+        return 0;
+    }
+    size_t off = 0;
+    return index_seek(doc, pos, &off)->content[off];
 }
 
 /**
  * Check if position needs newline before block element
  */
-static int needs_newline_before(const char *flat, size_t pos) {
+static int needs_newline_before(document *doc, size_t pos) {
     if (pos == 0) {
         return 0;  // At start of document
     }
-    size_t flat_len = strlen(flat);
-    char prev = get_char_at_pos(flat, flat_len, pos - 1);
-    return prev != '\n';
+    return get_char_at_pos(doc, pos - 1) != '\n';
 }
 
 /**
@@ -80,19 +245,12 @@ static int needs_newline_before(const char *flat, size_t pos) {
  */
 static int insert_block_element(document *doc, size_t pos, 
                                const char *marker) {
-    char *flat = markdown_flatten(doc);
-    if (!flat) {
-        return INVALID_CURSOR_POS;
-    }
-    
-    size_t flat_len = strlen(flat);
-    if (pos > flat_len) {
-        free(flat);
+    if (pos > get_pos_index(doc)->bytes) {
         return INVALID_CURSOR_POS;
     }
     
     int result = 0;
-    if (needs_newline_before(flat, pos)) {
+    if (needs_newline_before(doc, pos)) {
         // Need newline before marker
         char *with_newline = (char *)malloc(strlen(marker) + 2);
         sprintf(with_newline, "\n%s", marker);
@@ -103,7 +261,6 @@ static int insert_block_element(document *doc, size_t pos,
         result = add_text(doc, pos, marker);
     }
     
-    free(flat);
     return result;
 }
 
@@ -123,19 +280,479 @@ static int apply_range_format(document *doc, size_t start, size_t end,
 }
 
 /**
- * Free a segment list
+ * Free a segment list (the working list if working, else committed)
  */
-static void free_segment_list(text_segment *head) {
+static void free_segment_list(document *doc, text_segment *head, 
+                              int working) {
     text_segment *cur = head;
     text_segment *tmp = NULL;
     while (cur) {
         tmp = cur->next_segment;
-        free(cur->content);
-        free(cur);
+        segment_free(doc, cur, working);
         cur = tmp;
     }
 }
 
+/**
+ * Allocate a working-list segment for len bytes of text. Short text is 
+ * copied inline into the node; longer text must already be in one of 
+ * the document's buffers and is referenced in place. No segment ever 
+ * points at another segment's inline text, so nodes can be freed in any
+ * order. Every segment is created here so the memory counters stay exact
+ */
+static text_segment *segment_new(document *doc, const char *content, 
+                                 size_t len, enum seg_state state) {
+    size_t inline_len = (len <= SEG_INLINE_MAX) ? len : 0;
+    text_segment *seg = 
+        (text_segment *)malloc(sizeof(text_segment) + inline_len);
+    if (len <= SEG_INLINE_MAX) {
+        memcpy(seg->inline_text, content, len);
+        seg->content = seg->inline_text;
+        doc->stats.content_alloc_bytes += len;
+        doc->stats.buffer_bytes += len;
+    } else {
+        seg->content = content;
+    }
+    seg->length = len;
+    seg->state = state;
+    seg->next_segment = NULL;
+
+    doc->stats.segments[state]++;
+    doc->stats.working_segments++;
+    doc->stats.content_bytes += len;
+    doc->stats.working_bytes += len;
+    return seg;
+}
+
+/**
+ * Free one segment and take it off the counters. Buffered bytes stay in 
+ * the buffer until the next compaction; inline text goes with the node
+ */
+static void segment_free(document *doc, text_segment *seg, int working) {
+    if (seg->content == seg->inline_text) {
+        doc->stats.content_alloc_bytes -= seg->length;
+        doc->stats.buffer_bytes -= seg->length;
+    }
+    doc->stats.segments[seg->state]--;
+    doc->stats.content_bytes -= seg->length;
+    if (working) {
+        doc->stats.working_segments--;
+        doc->stats.working_bytes -= seg->length;
+    } else {
+        doc->stats.committed_segments--;
+    }
+    free(seg);
+}
+
+/**
+ * Shorten a working segment after a split; only the span changes. Inline
+ * text is counted at its current length
+ */
+static void segment_truncate(document *doc, text_segment *seg, size_t len) {
+    if (seg->content == seg->inline_text) {
+        doc->stats.content_alloc_bytes -= seg->length - len;
+        doc->stats.buffer_bytes -= seg->length - len;
+    }
+    doc->stats.content_bytes -= seg->length - len;
+    doc->stats.working_bytes -= seg->length - len;
+    seg->length = len;
+}
+
+static void segment_set_state(document *doc, text_segment *seg, 
+                              enum seg_state state) {
+    record_undo(doc, UNDO_STATE, seg, NULL, NULL, 0);
+    doc->stats.segments[seg->state]--;
+    doc->stats.segments[state]++;
+    seg->state = state;
+}
+
+/**
+ * Copy text to the end of the add buffer and return where it landed. 
+ * Blocks double in size up to TEXT_BLOCK_MAX; text that does not fit in
+ * the tail block starts a new one, so earlier bytes never move
+ */
+static const char *buffer_append(document *doc, const char *text, 
+                                 size_t len) {
+    struct text_block *tail = doc->add_tail;
+    if (len == 0) {
+        return "";
+    }
+    if (!tail || tail->cap - tail->used < len) {
+        size_t cap = tail ? tail->cap * 2 : TEXT_BLOCK_MIN;
+        if (cap > TEXT_BLOCK_MAX) {
+            cap = TEXT_BLOCK_MAX;
+        }
+        if (cap < len) {
+            cap = len;
+        }
+        struct text_block *block = 
+            (struct text_block *)malloc(sizeof(struct text_block) + cap);
+        block->next = NULL;
+        block->used = 0;
+        block->cap = cap;
+        if (tail) {
+            tail->next = block;
+        } else {
+            doc->add_head = block;
+        }
+        doc->add_tail = tail = block;
+        doc->stats.content_alloc_bytes += cap;
+    }
+
+    char *dst = tail->data + tail->used;
+    memcpy(dst, text, len);
+    tail->used += len;
+    doc->stats.buffer_bytes += len;
+    return dst;
+}
+
+/**
+ * Free a chain of buffer blocks and take them off the counters
+ */
+static void free_blocks(document *doc, struct text_block *block) {
+    while (block) {
+        struct text_block *next = block->next;
+        doc->stats.content_alloc_bytes -= block->cap;
+        doc->stats.buffer_bytes -= block->used;
+        free(block);
+        block = next;
+    }
+}
+
+/**
+ * Once most buffered bytes are dead (deleted text, replaced originals), 
+ * copy the committed text into a fresh original buffer as one segment 
+ * and release the old buffers. Only runs with no working list, so no 
+ * other segment points into the blocks being freed
+ */
+static void compact_buffers(document *doc) {
+    size_t live = doc->stats.content_bytes;
+    size_t dead = doc->stats.buffer_bytes - 
+                  (live < doc->stats.buffer_bytes ? live 
+                                                  : doc->stats.buffer_bytes);
+    if (doc->working_head || dead < COMPACT_MIN_DEAD_BYTES || dead < live) {
+        return;
+    }
+
+    struct text_block *block = 
+        (struct text_block *)malloc(sizeof(struct text_block) + live);
+    block->next = NULL;
+    block->used = live;
+    block->cap = live;
+    char *p = block->data;
+    for (const text_segment *n = doc->committed_head; n; 
+         n = n->next_segment) {
+        memcpy(p, n->content, n->length);
+        p += n->length;
+    }
+
+    free_segment_list(doc, doc->committed_head, 0);
+    doc->committed_head = NULL;
+    free_blocks(doc, doc->original);
+    free_blocks(doc, doc->add_head);
+    doc->add_head = doc->add_tail = NULL;
+
+    // Short text lives inline in the segment and needs no buffer
+    doc->original = NULL;
+    if (live > SEG_INLINE_MAX) {
+        doc->original = block;
+        doc->stats.content_alloc_bytes += live;
+        doc->stats.buffer_bytes += live;
+    }
+    if (live > 0) {
+        text_segment *seg = segment_new(doc, block->data, live, 
+                                        COMMITTED_ORIGINAL);
+        doc->stats.working_segments--;
+        doc->stats.working_bytes -= live;
+        doc->stats.committed_segments++;
+        doc->committed_head = seg;
+    }
+
+    // The runs pointed at the freed segments. Recounting the one segment
+    // costs about as much as the copy above, and the copy only happens 
+    // once as many bytes have died as are live
+    if (doc->pos_index) {
+        free_pos_index(doc, NULL, NULL);
+        get_pos_index(doc);
+    }
+    if (!doc->original) {
+        free(block);
+    }
+}
+
+/**
+ * Count a stretch of text piece by piece. The only full scan of text the
+ * index does; after it, the counts are reused for as long as any 
+ * segment points into the stretch
+ */
+static count_table *table_new(const char *text, size_t len, 
+                              size_t *table_bytes) {
+    count_table *table = (count_table *)malloc(sizeof(count_table));
+    table->refs = 1;
+    table->len = len;
+    table->count = (len + POS_INDEX_CHUNK - 1) / POS_INDEX_CHUNK;
+    table->cps = (size_t *)malloc((table->count + 1) * sizeof(size_t));
+    table->lines = (size_t *)malloc((table->count + 1) * sizeof(size_t));
+    table->cps[0] = 0;
+    table->lines[0] = 0;
+    for (size_t k = 0; k < table->count; k++) {
+        size_t off = k * POS_INDEX_CHUNK;
+        size_t take = (len - off < POS_INDEX_CHUNK) ? len - off 
+                                                    : POS_INDEX_CHUNK;
+        table->cps[k + 1] = table->cps[k] + 
+                            text_count_codepoints(text + off, take);
+        table->lines[k + 1] = table->lines[k] + 
+                              text_count_newlines(text + off, take);
+    }
+    *table_bytes += sizeof(count_table) + 
+                    2 * (table->count + 1) * sizeof(size_t);
+    return table;
+}
+
+static void table_release(count_table *table, size_t *table_bytes) {
+    if (--table->refs == 0) {
+        *table_bytes -= sizeof(count_table) + 
+                        2 * (table->count + 1) * sizeof(size_t);
+        free(table->cps);
+        free(table->lines);
+        free(table);
+    }
+}
+
+/**
+ * Drop an index and its references to the count tables. Freed table 
+ * memory is taken off *table_bytes, which may belong to the index that
+ * replaces this one. With no index given, the document's own is dropped
+ */
+static void free_pos_index(document *doc, struct pos_index *index, 
+                           size_t *table_bytes) {
+    if (!index) {
+        index = doc->pos_index;
+        doc->pos_index = NULL;
+        if (!index) {
+            return;
+        }
+        table_bytes = &index->table_bytes;
+    }
+    for (size_t i = 0; i < index->count; i++) {
+        table_release(index->runs[i].table, table_bytes);
+    }
+    free(index->runs);
+    free(index);
+}
+
+/**
+ * Append a run for seg to an index being built; its text holds cps code
+ * points and lines newlines
+ */
+static void index_push(struct pos_index *index, const pos_run *run, 
+                       size_t cps, size_t lines) {
+    if (index->count == index->cap) {
+        index->cap = index->cap ? index->cap * 2 : 16;
+        index->runs = (pos_run *)realloc(index->runs, 
+                                         index->cap * sizeof(pos_run));
+    }
+    pos_run *dst = &index->runs[index->count++];
+    *dst = *run;
+    dst->byte_start = index->bytes;
+    dst->cp_start = index->cps;
+    dst->line_start = index->lines;
+    index->bytes += run->seg->length;
+    index->cps += cps;
+    index->lines += lines;
+}
+
+/**
+ * Append seg as a run with a table of its own, counting its text
+ */
+static void index_push_new(struct pos_index *index, const text_segment *seg) {
+    pos_run run = {0};
+    run.seg = seg;
+    run.table = table_new(seg->content, seg->length, &index->table_bytes);
+    index_push(index, &run, run.table->cps[run.table->count], 
+               run.table->lines[run.table->count]);
+}
+
+/**
+ * Return the position index for the committed list, building it on first
+ * use; after that each commit patches it (patch_pos_index). One run per
+ * segment, found by binary search; inside a run, the count table narrows
+ * a lookup to at most POS_INDEX_CHUNK bytes of scanning
+ */
+static struct pos_index *get_pos_index(document *doc) {
+    if (doc->pos_index) {
+        return doc->pos_index;
+    }
+
+    struct pos_index *index = (struct pos_index *)calloc(1, sizeof(*index));
+    for (const text_segment *n = doc->committed_head; n; 
+         n = n->next_segment) {
+        if (n->length > 0) {
+            index_push_new(index, n);
+        }
+    }
+
+    doc->pos_index = index;
+    return index;
+}
+
+/**
+ * Index of the working list as it will be committed, made from the 
+ * current one. Every committed working segment is a piece of one old 
+ * segment, so it takes over that segment's count table, with the counts
+ * at its ends read from the table plus at most POS_INDEX_CHUNK bytes 
+ * each. Only inserted text is counted from scratch: a commit costs one 
+ * step per segment plus the bytes inserted, not the document size, and 
+ * reads after it never rebuild. Runs point at the working segments, 
+ * which become the committed list. Call while the pending states are 
+ * still set
+ */
+static struct pos_index *patch_pos_index(document *doc) {
+    const struct pos_index *old = doc->pos_index;
+    struct pos_index *index = (struct pos_index *)calloc(1, sizeof(*index));
+    index->table_bytes = old->table_bytes;
+    size_t j = 0;          // Old run holding old_pos
+    size_t old_pos = 0;    // Committed offset of the segment
+    for (const text_segment *w = doc->working_head; w; 
+         w = w->next_segment) {
+        if (w->length == 0) {
+            continue;
+        }
+        if (w->state == PENDING_INS) {
+            index_push_new(index, w);
+            continue;
+        }
+        if (w->state == PENDING_DEL) {
+            old_pos += w->length;
+            continue;
+        }
+
+        while (j + 1 < old->count && old->runs[j + 1].byte_start <= old_pos) {
+            j++;
+        }
+        const pos_run *from = &old->runs[j];
+        size_t off = old_pos - from->byte_start;
+        pos_run run = *from;
+        run.seg = w;
+        run.table->refs++;
+        run.table_off = from->table_off + off;
+        size_t cps = 0;
+        size_t lines = 0;
+        if (off == 0 && w->length == from->seg->length) {
+            // Whole segment: its counts are the gap to the next run
+            int last = (j + 1 == old->count);
+            cps = (last ? old->cps : from[1].cp_start) - from->cp_start;
+            lines = (last ? old->lines : from[1].line_start) - 
+                    from->line_start;
+        } else {
+            if (off > 0) {
+                run_counts_at(from, off, &run.table_cps, &run.table_lines);
+            }
+            run_counts_at(from, off + w->length, &cps, &lines);
+            cps -= run.table_cps;
+            lines -= run.table_lines;
+        }
+        index_push(index, &run, cps, lines);
+        old_pos += w->length;
+    }
+    return index;
+}
+
+/**
+ * Binary search for the last run starting at or before key, measured in
+ * bytes, code points or newlines. The index must not be empty
+ */
+static const pos_run *find_run(const struct pos_index *index, size_t key, 
+                               enum chunk_key by) {
+    size_t lo = 0;
+    size_t hi = index->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t start = (by == KEY_CP) ? index->runs[mid].cp_start 
+                     : (by == KEY_LINE) ? index->runs[mid].line_start 
+                     : index->runs[mid].byte_start;
+        if (start <= key) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &index->runs[lo];
+}
+
+/**
+ * Committed segment holding byte pos (< document length) and the offset
+ * of pos within it
+ */
+static const text_segment *index_seek(document *doc, size_t pos, 
+                                      size_t *off) {
+    const pos_run *run = find_run(get_pos_index(doc), pos, KEY_BYTE);
+    *off = pos - run->byte_start;
+    return run->seg;
+}
+
+/**
+ * Table counts before byte off of a run (0 <= off <= its length): the 
+ * piece boundary at or before it, plus a scan of under POS_INDEX_CHUNK
+ * bytes of the run's own text
+ */
+static void run_counts_at(const pos_run *run, size_t off, size_t *cps, 
+                          size_t *lines) {
+    size_t q = run->table_off + off;
+    size_t k = q / POS_INDEX_CHUNK;
+    size_t from = k * POS_INDEX_CHUNK;
+    if (from <= run->table_off) {
+        from = run->table_off;
+        *cps = run->table_cps;
+        *lines = run->table_lines;
+    } else {
+        *cps = run->table->cps[k];
+        *lines = run->table->lines[k];
+    }
+    const char *text = run->seg->content + (from - run->table_off);
+    *cps += text_count_codepoints(text, q - from);
+    *lines += text_count_newlines(text, q - from);
+}
+
+/**
+ * Where to start scanning a run for the point at which target code 
+ * points (or newlines) of the table lie before: the last piece boundary
+ * inside the run with at most target before it, else the run's start. 
+ * Returns the run offset and stores the table count before it in *base
+ */
+static size_t run_scan_start(const pos_run *run, size_t target, 
+                             enum chunk_key by, size_t *base) {
+    const size_t *counts = (by == KEY_CP) ? run->table->cps 
+                                          : run->table->lines;
+    size_t lo = run->table_off / POS_INDEX_CHUNK + 1;
+    size_t hi = (run->table_off + run->seg->length - 1) / POS_INDEX_CHUNK;
+    size_t found = 0;
+    while (lo <= hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (counts[mid] <= target) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (found == 0) {
+        *base = (by == KEY_CP) ? run->table_cps : run->table_lines;
+        return 0;
+    }
+    *base = counts[found];
+    return found * POS_INDEX_CHUNK - run->table_off;
+}
+
+/**
+ * Reject a committed position that falls inside a multibyte character.
+ * Positions past the end are left to the caller's range checks
+ */
+static int check_boundary(document *doc, size_t pos) {
+    return text_is_continuation(get_char_at_pos(doc, pos)) 
+        ? INVALID_CURSOR_POS : SUCCESS;
+}
+
 // === Init and Free ===
 
 /**
@@ -160,8 +777,12 @@ void markdown_free(document *doc) {
         return;
     }
     
-    free_segment_list(doc->committed_head);
-    free_segment_list(doc->working_head);
+    free_segment_list(doc, doc->committed_head, 0);
+    free_segment_list(doc, doc->working_head, 1);
+    free_pos_index(doc, NULL, NULL);
+    free_undo(doc);
+    free_blocks(doc, doc->original);
+    free_blocks(doc, doc->add_head);
     free(doc);                   // Free document structure itself
 }
 
@@ -178,8 +799,8 @@ int markdown_insert(document *doc, uint64_t version, size_t pos,
         return INVALID_CURSOR_POS;
     }
     
-    // Only accept edits on current version
-    int result = validate_version_op(doc, version);
+    // Only accept edits on current version, between characters
+    int result = validate_position_op(doc, version, pos);
     if (result != SUCCESS) {
         return result;
     }
@@ -196,15 +817,182 @@ int markdown_delete(document *doc, uint64_t version, size_t pos, size_t len) {
         return INVALID_CURSOR_POS;
     }
     
-    // Only accept edits on current version
-    int result = validate_version_op(doc, version);
+    // Only accept edits on current version, between characters
+    int result = validate_position_op(doc, version, pos);
     if (result != SUCCESS) {
         return result;
     }
+    size_t end = (len > SIZE_MAX - pos) ? SIZE_MAX : pos + len;
+    if (check_boundary(doc, end) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
     
     return remove_text(doc, pos, len);
 }
 
+/**
+ * Replace every occurrence of needle in the committed document with 
+ * replacement. One scan of the committed list finds the matches, 
+ * including those that span segments; each is then deleted and the
+ * replacement inserted before it. The edits run in ascending order, so 
+ * each resumes from the finger the previous one left, and a long 
+ * replacement is stored once and shared by every insertion
+ */
+int markdown_replace_all(document *doc, uint64_t version, 
+                         const char *needle, const char *replacement, 
+                         size_t *count) {
+    if (!doc || !needle || !replacement || !needle[0]) {
+        return INVALID_CURSOR_POS;
+    }
+    int result = validate_version_op(doc, version);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    size_t nlen = strlen(needle);
+    size_t *matches = NULL;
+    size_t found = find_matches(doc, needle, nlen, &matches);
+    if (count) {
+        *count = found;
+    }
+    if (found == 0) {
+        free(matches);
+        return SUCCESS;
+    }
+
+    if (!doc->working_head) {
+        sync_working(doc);
+    }
+    size_t rlen = strlen(replacement);
+    const char *text = (rlen > 0) ? store_text(doc, replacement, rlen) 
+                                  : NULL;
+    for (size_t i = 0; i < found; i++) {
+        if (text) {
+            put_stored(doc, matches[i], text, rlen);
+        }
+        remove_text(doc, matches[i], nlen);
+    }
+    free(matches);
+    return SUCCESS;
+}
+
+/**
+ * Insert content at every given committed position, e.g. one per cursor.
+ * All positions are checked before anything changes, so either every 
+ * insertion happens or none does. They are then applied in ascending 
+ * order, each resuming from the finger the previous one left, so the 
+ * list is walked once; the text is stored once and shared
+ */
+int markdown_multi_insert(document *doc, uint64_t version, 
+                          const char *content, const size_t *positions, 
+                          size_t count) {
+    if (!doc || !content || !content[0] || !positions || count == 0) {
+        return INVALID_CURSOR_POS;
+    }
+    int result = validate_version_op(doc, version);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    size_t *sorted = NULL;
+    count = sort_positions(positions, count, &sorted);
+    size_t length = get_pos_index(doc)->bytes;
+    for (size_t i = 0; i < count; i++) {
+        if (sorted[i] > length || check_boundary(doc, sorted[i]) != SUCCESS) {
+            free(sorted);
+            return INVALID_CURSOR_POS;
+        }
+    }
+
+    if (!doc->working_head) {
+        sync_working(doc);
+    }
+    size_t len = strlen(content);
+    const char *text = store_text(doc, content, len);
+    for (size_t i = 0; i < count; i++) {
+        put_stored(doc, sorted[i], text, len);
+    }
+    free(sorted);
+    return SUCCESS;
+}
+
+/**
+ * Delete len bytes at every given committed position, checked and 
+ * applied like markdown_multi_insert. Overlapping ranges are deleted once
+ */
+int markdown_multi_delete(document *doc, uint64_t version, size_t len, 
+                          const size_t *positions, size_t count) {
+    if (!doc || !positions || count == 0) {
+        return INVALID_CURSOR_POS;
+    }
+    int result = validate_version_op(doc, version);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    size_t *sorted = NULL;
+    count = sort_positions(positions, count, &sorted);
+    size_t length = get_pos_index(doc)->bytes;
+    for (size_t i = 0; i < count; i++) {
+        size_t end = (len > SIZE_MAX - sorted[i]) ? SIZE_MAX 
+                                                  : sorted[i] + len;
+        if (sorted[i] > length || check_boundary(doc, sorted[i]) != SUCCESS ||
+            check_boundary(doc, end) != SUCCESS) {
+            free(sorted);
+            return INVALID_CURSOR_POS;
+        }
+    }
+
+    for (size_t i = 0; i < count && len > 0; i++) {
+        remove_text(doc, sorted[i], len);
+    }
+    free(sorted);
+    return SUCCESS;
+}
+
+/**
+ * Copy the committed range [start, start + len) to dest, sharing its text
+ */
+int markdown_copy(document *doc, uint64_t version, size_t start, size_t len,
+                  size_t dest) {
+    if (!doc) {
+        return INVALID_CURSOR_POS;
+    }
+    size_t end = (len > SIZE_MAX - start) ? SIZE_MAX : start + len;
+    int result = validate_range_op(doc, version, start, end);
+    if (result != SUCCESS) {
+        return result;
+    }
+    size_t length = get_pos_index(doc)->bytes;
+    if (end > length || dest > length || 
+        check_boundary(doc, dest) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
+    return copy_range(doc, start, len, dest);
+}
+
+/**
+ * Move the committed range [start, start + len) to dest: the range is 
+ * marked deleted and its segments are relinked, as shared copies, at 
+ * dest. dest is in the same committed coordinates and may not fall 
+ * strictly inside the range
+ */
+int markdown_move(document *doc, uint64_t version, size_t start, size_t len,
+                  size_t dest) {
+    if (!doc) {
+        return INVALID_CURSOR_POS;
+    }
+    size_t end = (len > SIZE_MAX - start) ? SIZE_MAX : start + len;
+    if (dest > start && dest < end) {
+        return INVALID_CURSOR_POS;
+    }
+    int result = markdown_copy(doc, version, start, len, dest);
+    if (result != SUCCESS) {
+        return result;
+    }
+    return remove_text(doc, start, len);
+}
+
 // === Formatting Commands ===
 
 /**
@@ -216,8 +1004,8 @@ int markdown_newline(document *doc, uint64_t version, size_t pos) {
         return INVALID_CURSOR_POS;
     }
     
-    // Only accept edits on current version
-    int result = validate_version_op(doc, version);
+    // Only accept edits on current version, between characters
+    int result = validate_position_op(doc, version, pos);
     if (result != SUCCESS) {
         return result;
     }
@@ -233,7 +1021,7 @@ int markdown_newline(document *doc, uint64_t version, size_t pos) {
  */
 int markdown_heading(document *doc, uint64_t version, size_t level, 
                     size_t pos) {
-    int result = validate_version_op(doc, version);
+    int result = validate_position_op(doc, version, pos);
     if (result != SUCCESS) {
         return result;
     }
@@ -337,6 +1125,10 @@ int markdown_blockquote(document *doc, uint64_t version, size_t pos) {
         return OUTDATED_VERSION;
     }
 
+    if (check_boundary(doc, pos) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
+
     return insert_block_element(doc, pos, "> ");
 }
 
@@ -348,13 +1140,16 @@ int markdown_ordered_list(document *doc, uint64_t version, size_t pos) {
     if (doc->current_version != version) {
         return OUTDATED_VERSION;
     }
+    if (check_boundary(doc, pos) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
     
-    char *flat = markdown_flatten(doc);
+    size_t flat_len = 0;
+    char *flat = flatten_committed(doc, &flat_len, NULL);
     if (!flat) {
         return INVALID_CURSOR_POS;
     }
     
-    size_t flat_len = strlen(flat);
     if (pos > flat_len) {
         free(flat);
         return INVALID_CURSOR_POS;
@@ -367,23 +1162,12 @@ int markdown_ordered_list(document *doc, uint64_t version, size_t pos) {
     int prev_num = 0;
     if (pos > 0) {
         // Find start of previous line
-        int i = (int)pos - 2;
-        while (i >= 0 && flat[i] != '\n') {
-            i--;
-        }
-        size_t prev_line_start = (i >= 0) ? (size_t)(i + 1) : 0;
+        size_t nl = text_rfind_newline(flat, pos - 1);
+        size_t prev_line_start = (nl != TEXT_NPOS) ? nl + 1 : 0;
 
         // Check if previous line is numbered list
-        if (isdigit(flat[prev_line_start])) {
-            size_t n = 0;
-            while (isdigit(flat[prev_line_start + n])) {
-                n++;
-            }
-            if (flat[prev_line_start + n] == '.' && 
-                flat[prev_line_start + n + 1] == ' ') {
-                prev_num = atoi(flat + prev_line_start);
-            }
-        }
+        text_match_list_prefix(flat + prev_line_start, 
+                               flat_len - prev_line_start, &prev_num);
     }
     
     int new_num = prev_num + 1;
@@ -409,34 +1193,24 @@ int markdown_ordered_list(document *doc, uint64_t version, size_t pos) {
     
     while (scan < flat_len) {
         // Find next line
-        size_t next_line = scan;
-        while (next_line < flat_len && flat[next_line] != '\n') {
-            next_line++;
-        }
-        if (next_line >= flat_len) {
+        size_t nl = text_find_newline(flat + scan, flat_len - scan);
+        if (nl == TEXT_NPOS) {
             break;
         }
-        next_line++; // skip the '\n'
+        size_t next_line = scan + nl + 1; // skip the '\n'
 
         // Check if it's a numbered list item
-        if (isdigit(flat[next_line])) {
-            size_t n = 0;
-            while (isdigit(flat[next_line + n])) {
-                n++;
-            }
+        size_t old_len = text_match_list_prefix(flat + next_line, 
+                                                flat_len - next_line, NULL);
+        if (old_len > 0) {
+            // Renumber this item
+            char new_prefix[20];
+            snprintf(new_prefix, sizeof(new_prefix), "%d. ", next_num++);
             
-            if (flat[next_line + n] == '.' && 
-                flat[next_line + n + 1] == ' ') {
-                // Renumber this item
-                size_t old_len = n + 2;
-                char new_prefix[20];
-                snprintf(new_prefix, sizeof(new_prefix), "%d. ", next_num++);
-                
-                remove_text(doc, next_line, old_len);
-                add_text(doc, next_line, new_prefix);
-                scan = next_line + strlen(new_prefix);
-                continue;
-            }
+            remove_text(doc, next_line, old_len);
+            add_text(doc, next_line, new_prefix);
+            scan = next_line + strlen(new_prefix);
+            continue;
         }
         break; // Not a numbered line, stop renumbering
     }
@@ -456,6 +1230,10 @@ int markdown_unordered_list(document *doc, uint64_t version, size_t pos) {
         return OUTDATED_VERSION;
     }
     
+    if (check_boundary(doc, pos) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
+
     return insert_block_element(doc, pos, "- ");
 }
 
@@ -484,6 +1262,10 @@ int markdown_horizontal_rule(document *doc, uint64_t version, size_t pos) {
     }
 
     // Insert horizontal rule as a complete block element including trailing newline
+    if (check_boundary(doc, pos) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
+
     return insert_block_element(doc, pos, "---\n");
 }
 
@@ -531,26 +1313,278 @@ void markdown_print(const document *doc, FILE *stream) {
  * Only includes committed content, not working changes
  */
 char *markdown_flatten(const document *doc) {
-    const text_segment *lst = doc->committed_head;
-    
-    // Calculate total length needed
     size_t total = 0;
-    for (const text_segment *n = lst; n; n = n->next_segment) {
-        total += n->length;
+    return flatten_committed(doc, &total, NULL);
+}
+
+/**
+ * Flatten and checksum the committed document in the same pass
+ */
+char *markdown_flatten_checksum(const document *doc, size_t *len, 
+                                uint32_t *adler) {
+    size_t total = 0;
+    uint32_t sum = 1;
+    char *buf = flatten_committed(doc, &total, &sum);
+    if (len) {
+        *len = total;
     }
-    
-    // Allocate buffer and copy all text segments
-    char *buf = (char *)malloc(total + 1);
-    char *p = buf;
-    for (const text_segment *n = lst; n; n = n->next_segment) {
-        memcpy(p, n->content, n->length);
-        p += n->length;
+    if (adler) {
+        *adler = sum;
     }
+    return buf;
+}
+
+// One worker's share of a flatten: bytes [start, end) of the document, 
+// beginning at offset first_off of segment first
+typedef struct {
+    const text_segment *first;
+    size_t first_off;
+    size_t start;
+    size_t end;
+    char *dst;
+    int checksum;
+    uint32_t adler;
+} flatten_job;
+
+/**
+ * Copy one share of the document. With a checksum, bytes are summed from
+ * the destination block by block, right after they were written
+ */
+static void *flatten_worker(void *arg) {
+    flatten_job *job = (flatten_job *)arg;
+    const text_segment *n = job->first;
+    size_t off = job->first_off;
+    char *p = job->dst + job->start;
+    size_t remain = job->end - job->start;
+    job->adler = 1;
+
+    while (n && remain > 0) {
+        size_t len = n->length - off;
+        if (len > remain) {
+            len = remain;
+        }
+        const char *src = n->content + off;
+        for (size_t done = 0; done < len; ) {
+            size_t step = len - done;
+            if (step > FLATTEN_BLOCK) {
+                step = FLATTEN_BLOCK;
+            }
+            memcpy(p, src + done, step);
+            if (job->checksum) {
+                job->adler = text_adler32(job->adler, p, step);
+            }
+            p += step;
+            done += step;
+        }
+        remain -= len;
+        off = 0;
+        n = n->next_segment;
+    }
+    return NULL;
+}
+
+/**
+ * Flatten the committed list and report its length, so callers do not 
+ * have to strlen a multi-megabyte buffer. The length is known from the 
+ * memory counters, so large documents are cut into equal byte ranges 
+ * after one walk to find where each range starts, and the ranges are 
+ * copied (and checksummed, with adler) by parallel workers
+ */
+static char *flatten_committed(const document *doc, size_t *out_len, 
+                               uint32_t *adler) {
+    // The position index is a cache over the committed list, so filling
+    // it in does not change the document
+    size_t total = markdown_length((document *)doc);
+    char *buf = (char *)malloc(total + 1);
     buf[total] = 0; // Null terminate
+    *out_len = total;
+
+    size_t workers = 1;
+    if (total >= FLATTEN_PARALLEL_MIN) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = total / FLATTEN_WORKER_MIN;
+        if (cpus > 0 && workers > (size_t)cpus) {
+            workers = (size_t)cpus;
+        }
+        if (workers > FLATTEN_MAX_WORKERS) {
+            workers = FLATTEN_MAX_WORKERS;
+        }
+        if (workers < 1) {
+            workers = 1;
+        }
+    }
+
+    // Find the segment each share starts in
+    flatten_job jobs[FLATTEN_MAX_WORKERS];
+    const text_segment *n = doc->committed_head;
+    size_t seen = 0;
+    for (size_t w = 0; w < workers; w++) {
+        size_t start = total / workers * w;
+        while (n && seen + n->length <= start && w > 0) {
+            seen += n->length;
+            n = n->next_segment;
+        }
+        jobs[w].first = n;
+        jobs[w].first_off = start - seen;
+        jobs[w].start = start;
+        jobs[w].end = (w + 1 < workers) ? total / workers * (w + 1) : total;
+        jobs[w].dst = buf;
+        jobs[w].checksum = (adler != NULL);
+    }
+
+    // The caller takes the first share; a worker that cannot be started
+    // is run inline too
+    pthread_t threads[FLATTEN_MAX_WORKERS];
+    int started[FLATTEN_MAX_WORKERS] = {0};
+    for (size_t w = 1; w < workers; w++) {
+        started[w] = (pthread_create(&threads[w], NULL, flatten_worker, 
+                                     &jobs[w]) == 0);
+    }
+    flatten_worker(&jobs[0]);
+    for (size_t w = 1; w < workers; w++) {
+        if (started[w]) {
+            pthread_join(threads[w], NULL);
+        } else {
+            flatten_worker(&jobs[w]);
+        }
+    }
+
+    if (adler) {
+        *adler = jobs[0].adler;
+        for (size_t w = 1; w < workers; w++) {
+            *adler = text_adler32_combine(*adler, jobs[w].adler, 
+                                          jobs[w].end - jobs[w].start);
+        }
+    }
     return buf;
 }
 
+/**
+ * Report the document's memory counters. Overhead and fragmentation are 
+ * derived from the running totals, so no list is traversed
+ */
+void markdown_stats(const document *doc, md_stats *stats) {
+    *stats = doc->stats;
+
+    size_t headers = doc->stats.segments[COMMITTED_ORIGINAL] + 
+                     doc->stats.segments[PENDING_INS] + 
+                     doc->stats.segments[PENDING_DEL];
+    stats->overhead_bytes = headers * sizeof(text_segment) + sizeof(document);
+    if (doc->pos_index) {
+        stats->overhead_bytes += sizeof(struct pos_index) + 
+                                 doc->pos_index->cap * sizeof(pos_run) + 
+                                 doc->pos_index->table_bytes;
+    }
+    size_t committed = doc->stats.content_bytes - doc->stats.working_bytes;
+    stats->fragmentation = (doc->stats.buffer_bytes > committed)
+        ? 1.0 - (double)committed / (double)doc->stats.buffer_bytes
+        : 0.0;
+}
+
+
 
+static int compare_positions(const void *a, const void *b) {
+    size_t x = *(const size_t *)a;
+    size_t y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Ascending copy of positions without duplicates, in a malloc'd array.
+ * Returns the number kept
+ */
+static size_t sort_positions(const size_t *positions, size_t count, 
+                             size_t **out) {
+    size_t *sorted = (size_t *)malloc(count * sizeof(size_t));
+    memcpy(sorted, positions, count * sizeof(size_t));
+    qsort(sorted, count, sizeof(size_t), compare_positions);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (kept == 0 || sorted[i] != sorted[kept - 1]) {
+            sorted[kept++] = sorted[i];
+        }
+    }
+    *out = sorted;
+    return kept;
+}
+
+/**
+ * 1 if the committed text from offset off of segment n onwards starts 
+ * with needle, following the list across segment boundaries
+ */
+static int match_at(const text_segment *n, size_t off, const char *needle, 
+                    size_t len) {
+    while (len > 0) {
+        if (!n) {
+            return 0;
+        }
+        size_t take = n->length - off;
+        if (take > len) {
+            take = len;
+        }
+        if (memcmp(n->content + off, needle, take) != 0) {
+            return 0;
+        }
+        needle += take;
+        len -= take;
+        n = n->next_segment;
+        off = 0;
+    }
+    return 1;
+}
+
+/**
+ * Committed offsets of the non-overlapping occurrences of needle, left to
+ * right, in a malloc'd array. Candidates are found with memchr on the 
+ * first byte within each segment and confirmed with match_at. Matches 
+ * that would split a multibyte character are skipped
+ */
+static size_t find_matches(document *doc, const char *needle, size_t len, 
+                           size_t **out) {
+    size_t count = 0;
+    size_t cap = 0;
+    *out = NULL;
+    if (text_is_continuation(needle[0])) {
+        return 0;
+    }
+
+    size_t base = 0;     // Committed offset of n
+    size_t off = 0;      // Scan position within n
+    const text_segment *n = doc->committed_head;
+    while (n) {
+        const char *hit = (off < n->length) 
+            ? memchr(n->content + off, needle[0], n->length - off) : NULL;
+        if (!hit) {
+            base += n->length;
+            n = n->next_segment;
+            off = 0;
+            continue;
+        }
+        off = (size_t)(hit - n->content);
+        if (!match_at(n, off, needle, len) || 
+            check_boundary(doc, base + off + len) != SUCCESS) {
+            off++;
+            continue;
+        }
+
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            *out = (size_t *)realloc(*out, cap * sizeof(size_t));
+        }
+        (*out)[count++] = base + off;
+
+        // Resume after the match, which may end in a later segment
+        size_t skip = len;
+        while (n && skip >= n->length - off) {
+            skip -= n->length - off;
+            base += n->length;
+            n = n->next_segment;
+            off = 0;
+        }
+        off += skip;
+    }
+    return count;
+}
 
 // === Versioning ===
 
@@ -559,12 +1593,14 @@ char *markdown_flatten(const document *doc) {
  * Promotes working list to committed, removes deleted segments
  */
 void markdown_increment_version(document *doc) {
+    free_undo(doc);                 // Committed changes cannot be undone
     if (!doc->working_head) {
         return;
     }
+    struct pos_index *index = doc->pos_index ? patch_pos_index(doc) : NULL;
     
     // Free old committed list
-    free_segment_list(doc->committed_head);
+    free_segment_list(doc, doc->committed_head, 0);
     doc->committed_head = NULL;
 
     // Promote working list to committed, filtering out deleted segments
@@ -578,59 +1614,613 @@ void markdown_increment_version(document *doc) {
         if (cur->state != PENDING_DEL) {
             // Keep this segment - convert inserted segments to original
             if (cur->state == PENDING_INS) {
-                cur->state = COMMITTED_ORIGINAL;
+                segment_set_state(doc, cur, COMMITTED_ORIGINAL);
             }
             cur->next_segment = NULL;
             *tail = cur;
             tail = &(cur->next_segment);
+            doc->stats.committed_segments++;
         } else {
             // Remove deleted segment
-            free(cur->content);
-            free(cur);
+            segment_free(doc, cur, 1);
         }
         cur = tmp;
     }
     
+    // Everything left the working list
+    doc->stats.working_segments = 0;
+    doc->stats.working_bytes = 0;
+    
     doc->working_head = NULL;       // Clear working list
+    clear_finger(doc);              // Its nodes moved or were freed
+    if (index) {                    // Old index pointed into the old list
+        free_pos_index(doc, doc->pos_index, &index->table_bytes);
+        doc->pos_index = index;
+    }
+    compact_buffers(doc);           // Reclaim dead text, if enough
     doc->current_version += 1;      // Increment version number
 }
 
+/**
+ * Drop every pending change so the working list matches the committed
+ * document again. Text already appended to the add buffer stays until
+ * the next compaction
+ */
+void markdown_discard_pending(document *doc) {
+    free_undo(doc);
+    free_segment_list(doc, doc->working_head, 1);
+    doc->working_head = NULL;
+    clear_finger(doc);
+}
+
+// === Savepoints ===
+
+/**
+ * Note one working-list change while a savepoint is open. seg is the 
+ * segment changed; its old length or state is read from it here
+ */
+static void record_undo(document *doc, enum undo_kind kind, 
+                        text_segment *seg, text_segment *prev, 
+                        text_segment *last, size_t len) {
+    struct md_undo *undo = doc->undo;
+    if (!undo) {
+        return;
+    }
+    if (undo->count == undo->cap) {
+        size_t cap = undo->cap ? undo->cap * 2 : 16;
+        undo_entry *grown = (undo_entry *)realloc(undo->entries, 
+                                                  cap * sizeof(undo_entry));
+        if (!grown) {
+            return;
+        }
+        undo->entries = grown;
+        undo->cap = cap;
+    }
+    undo_entry *e = &undo->entries[undo->count++];
+    e->kind = kind;
+    e->seg = seg;
+    e->prev = prev;
+    e->last = last;
+    e->len = len;
+    e->state = seg->state;
+}
+
+static void free_undo(document *doc) {
+    if (doc->undo) {
+        free(doc->undo->entries);
+        free(doc->undo);
+        doc->undo = NULL;
+    }
+}
+
+/**
+ * Start recording working-list changes. Edits only ever split segments, 
+ * link new pending segments in and mark segments deleted, so those three
+ * changes are all a rollback needs
+ */
+void markdown_savepoint(document *doc) {
+    free_undo(doc);
+    doc->undo = (struct md_undo *)calloc(1, sizeof(struct md_undo));
+    if (doc->undo) {
+        doc->undo->was_empty = (doc->working_head == NULL);
+    }
+}
+
+/**
+ * Reverse the recorded changes newest first, which puts every link back 
+ * exactly as it was: a later change never depends on an earlier one 
+ * still being undone. A working list created since the savepoint is 
+ * simply dropped
+ */
+void markdown_rollback(document *doc) {
+    struct md_undo *undo = doc->undo;
+    if (!undo) {
+        return;
+    }
+    doc->undo = NULL;  // Nothing below is recorded
+    if (undo->was_empty) {
+        free_segment_list(doc, doc->working_head, 1);
+        doc->working_head = NULL;
+    } else {
+        for (size_t i = undo->count; i-- > 0; ) {
+            undo_entry *e = &undo->entries[i];
+            if (e->kind == UNDO_STATE) {
+                segment_set_state(doc, e->seg, e->state);
+            } else if (e->kind == UNDO_LINK) {
+                text_segment *after = e->last->next_segment;
+                if (e->prev) {
+                    e->prev->next_segment = after;
+                } else {
+                    doc->working_head = after;
+                }
+                e->last->next_segment = NULL;
+                free_segment_list(doc, e->seg, 1);
+            } else {
+                // Give the split-off tail back to the segment
+                text_segment *seg = e->seg;
+                text_segment *tail = seg->next_segment;
+                size_t grow = e->len - seg->length;
+                seg->next_segment = tail->next_segment;
+                if (seg->content == seg->inline_text) {
+                    doc->stats.content_alloc_bytes += grow;
+                    doc->stats.buffer_bytes += grow;
+                }
+                doc->stats.content_bytes += grow;
+                doc->stats.working_bytes += grow;
+                seg->length = e->len;
+                segment_free(doc, tail, 1);
+            }
+        }
+    }
+    clear_finger(doc);  // It may point at a freed segment
+    free(undo->entries);
+    free(undo);
+}
+
+void markdown_release(document *doc) {
+    free_undo(doc);
+}
+
+// === Region shards ===
+
+/**
+ * Cut the working list into shards at the given committed offsets, 
+ * splitting a segment where a cut falls inside it. Each shard is a copy 
+ * of the document whose working list is its own run of segments, ending
+ * in NULL, and which starts counting at working_base; it shares the 
+ * committed list and position index (built here, read only while the 
+ * shards are out) and gets its own finger, counters and add buffer, so 
+ * edits to different shards touch no common memory. Only cuts strictly 
+ * inside the document and above the previous cut are used, so no shard 
+ * is empty
+ */
+md_shard *markdown_shards_split(document *doc, const size_t *cuts, 
+                                size_t count, size_t *shards_out) {
+    md_shard *shards = (md_shard *)calloc(count + 1, sizeof(md_shard));
+    if (!shards) {
+        return NULL;
+    }
+    if (!doc->working_head) {
+        sync_working(doc);
+    }
+    size_t length = get_pos_index(doc)->bytes;
+
+    text_segment *prev = NULL;
+    text_segment *cur = doc->working_head;
+    size_t seen = 0;
+    size_t made = 0;
+    for (size_t i = 0; ; i++) {
+        // Next usable cut, or the end of the document
+        while (i < count && (cuts[i] <= seen || cuts[i] >= length)) {
+            i++;
+        }
+        md_shard *shard = &shards[made++];
+        shard->doc = *doc;
+        shard->doc.working_head = cur;
+        shard->doc.working_base = seen;
+        shard->doc.add_head = shard->doc.add_tail = NULL;
+        shard->doc.undo = NULL;
+        memset(&shard->doc.stats, 0, sizeof(md_stats));
+        clear_finger(&shard->doc);
+        shard->start = seen;
+        if (i >= count) {
+            shard->end = length;
+            break;
+        }
+
+        // Same walk as put_chain, so insertions at the cut stay with the
+        // text after it
+        size_t cut = cuts[i];
+        while (cur && (cur->state == PENDING_INS ? seen < cut 
+                                                 : seen + cur->length <= cut)) {
+            if (cur->state != PENDING_INS) {
+                seen += cur->length;
+            }
+            prev = cur;
+            cur = cur->next_segment;
+        }
+        if (cur && cur->state != PENDING_INS && cut > seen) {
+            prev = cur;
+            cur = split_segment(doc, cur, cut - seen);
+            seen = cut;
+        }
+        shard->end = cut;
+        shard->tail = prev;
+        prev->next_segment = NULL;
+    }
+    *shards_out = made;
+    return shards;
+}
+
+/**
+ * Join shards split off by markdown_shards_split (count of them, one 
+ * more than the cuts) back into one working list. A shard's edits only 
+ * ever add segments after its original tail, so the new tail is found 
+ * from there. Counters are unsigned and fold back by wrapping addition
+ */
+void markdown_shards_join(document *doc, md_shard *shards, size_t count) {
+    doc->working_head = shards[0].doc.working_head;
+    for (size_t i = 0; i < count; i++) {
+        const document *part = &shards[i].doc;
+        if (i + 1 < count) {
+            text_segment *tail = shards[i].tail;
+            while (tail->next_segment) {
+                tail = tail->next_segment;
+            }
+            tail->next_segment = shards[i + 1].doc.working_head;
+        }
+
+        for (int state = 0; state < 3; state++) {
+            doc->stats.segments[state] += part->stats.segments[state];
+        }
+        doc->stats.committed_segments += part->stats.committed_segments;
+        doc->stats.working_segments += part->stats.working_segments;
+        doc->stats.content_bytes += part->stats.content_bytes;
+        doc->stats.content_alloc_bytes += part->stats.content_alloc_bytes;
+        doc->stats.buffer_bytes += part->stats.buffer_bytes;
+        doc->stats.working_bytes += part->stats.working_bytes;
+
+        if (part->add_head) {
+            if (doc->add_tail) {
+                doc->add_tail->next = part->add_head;
+            } else {
+                doc->add_head = part->add_head;
+            }
+            doc->add_tail = part->add_tail;
+        }
+    }
+    clear_finger(doc);
+    free(shards);
+}
+
+// === Positions ===
+
+/**
+ * Length of the committed document, as the position index counts it
+ */
+size_t markdown_length(document *doc) {
+    return get_pos_index(doc)->bytes;
+}
+
+/**
+ * Map a position in the committed document to where it will sit once the
+ * pending working changes are committed. Text inserted at the position
+ * pushes it right; a position inside a deleted range collapses to the 
+ * start of that range. Must be called before markdown_increment_version
+ */
+size_t markdown_transform_position(const document *doc, size_t pos) {
+    size_t seen = 0;     // Position in committed coordinates
+    size_t mapped = 0;   // Position in next-version coordinates
+
+    for (const text_segment *cur = doc->working_head; cur; 
+         cur = cur->next_segment) {
+        if (cur->state == PENDING_INS) {
+            if (seen <= pos) {
+                mapped += cur->length;
+            }
+            continue;
+        }
+        if (pos < seen + cur->length) {
+            if (cur->state == COMMITTED_ORIGINAL) {
+                mapped += pos - seen;
+            }
+            return mapped;
+        }
+        if (cur->state == COMMITTED_ORIGINAL) {
+            mapped += cur->length;
+        }
+        seen += cur->length;
+    }
+
+    // No working list means nothing changes this version
+    return doc->working_head ? mapped : pos;
+}
+
+/**
+ * One position of a markdown_transform_positions call, in walk order
+ */
+typedef struct {
+    size_t pos;
+    size_t slot;    // Where it came from in the caller's array
+    int left;       // Range end: placed before insertions at pos
+} pending_pos;
+
+static int compare_pending(const void *a, const void *b) {
+    const pending_pos *x = (const pending_pos *)a;
+    const pending_pos *y = (const pending_pos *)b;
+    if (x->pos != y->pos) {
+        return (x->pos > y->pos) - (x->pos < y->pos);
+    }
+    return y->left - x->left;
+}
+
+/**
+ * markdown_transform_position for many positions: sorted once, they are 
+ * resolved in the same walk, so the cost is one pass over the working 
+ * list plus the sort, not a pass per position
+ */
+void markdown_transform_positions(const document *doc, size_t *positions, 
+                                  const char *range_end, size_t count) {
+    if (!doc->working_head || count == 0) {
+        return;
+    }
+    pending_pos *order = (pending_pos *)malloc(count * sizeof(pending_pos));
+    if (!order) {
+        for (size_t i = 0; i < count; i++) {
+            positions[i] = markdown_transform_position(doc, positions[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        order[i].pos = positions[i];
+        order[i].slot = i;
+        order[i].left = range_end && range_end[i];
+    }
+    qsort(order, count, sizeof(pending_pos), compare_pending);
+
+    size_t seen = 0;     // Position in committed coordinates
+    size_t mapped = 0;   // Position in next-version coordinates
+    size_t next = 0;     // First position not yet placed
+    for (const text_segment *cur = doc->working_head; cur && next < count;
+         cur = cur->next_segment) {
+        if (cur->state == PENDING_INS) {
+            // Every position left is at or after seen
+            while (next < count && order[next].pos == seen && 
+                   order[next].left) {
+                positions[order[next++].slot] = mapped;
+            }
+            mapped += cur->length;
+            continue;
+        }
+        while (next < count && order[next].pos < seen + cur->length) {
+            positions[order[next].slot] = mapped + 
+                ((cur->state == COMMITTED_ORIGINAL) ? order[next].pos - seen 
+                                                     : 0);
+            next++;
+        }
+        if (cur->state == COMMITTED_ORIGINAL) {
+            mapped += cur->length;
+        }
+        seen += cur->length;
+    }
+    for (; next < count; next++) {
+        size_t past = order[next].pos - seen;
+        positions[order[next].slot] = (past > SIZE_MAX - mapped) 
+                                    ? SIZE_MAX : mapped + past;
+    }
+    free(order);
+}
+
+/**
+ * Byte offset of the cp-th code point in the committed document. The 
+ * index gives the segment and the piece holding it in O(log n)
+ */
+int markdown_cp_to_byte(document *doc, size_t cp, size_t *byte) {
+    if (!doc || !byte) {
+        return INVALID_CURSOR_POS;
+    }
+    struct pos_index *index = get_pos_index(doc);
+    if (cp > index->cps) {
+        return INVALID_CURSOR_POS;
+    }
+    if (cp == index->cps) {
+        *byte = index->bytes;
+        return SUCCESS;
+    }
+
+    const pos_run *run = find_run(index, cp, KEY_CP);
+    size_t target = run->table_cps + (cp - run->cp_start);
+    size_t base = 0;
+    size_t off = run_scan_start(run, target, KEY_CP, &base);
+    *byte = run->byte_start + off + 
+            text_codepoint_offset(run->seg->content + off, 
+                                  run->seg->length - off, target - base);
+    return SUCCESS;
+}
+
+/**
+ * Code-point offset of a byte position in the committed document
+ */
+int markdown_byte_to_cp(document *doc, size_t byte, size_t *cp) {
+    if (!doc || !cp) {
+        return INVALID_CURSOR_POS;
+    }
+    struct pos_index *index = get_pos_index(doc);
+    if (byte > index->bytes || check_boundary(doc, byte) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
+    if (byte == index->bytes) {
+        *cp = index->cps;
+        return SUCCESS;
+    }
+
+    const pos_run *run = find_run(index, byte, KEY_BYTE);
+    size_t cps = 0;
+    size_t lines = 0;
+    run_counts_at(run, byte - run->byte_start, &cps, &lines);
+    *cp = run->cp_start + (cps - run->table_cps);
+    return SUCCESS;
+}
+
+/**
+ * Byte offset of the start of a line (counted from 0) in the committed
+ * document. The segment and piece holding the line-th newline are found
+ * in O(log n), then at most POS_INDEX_CHUNK bytes are scanned for it
+ */
+int markdown_offset_of_line(document *doc, size_t line, size_t *byte) {
+    if (!doc || !byte) {
+        return INVALID_CURSOR_POS;
+    }
+    struct pos_index *index = get_pos_index(doc);
+    if (line > index->lines) {
+        return INVALID_CURSOR_POS;
+    }
+    if (line == 0) {
+        *byte = 0;
+        return SUCCESS;
+    }
+
+    // Last run with fewer than line newlines before it holds the one 
+    // that ends line - 1; target newlines of its table come before that
+    const pos_run *run = find_run(index, line - 1, KEY_LINE);
+    size_t target = run->table_lines + (line - 1 - run->line_start);
+    size_t base = 0;
+    size_t off = run_scan_start(run, target, KEY_LINE, &base);
+    const char *text = run->seg->content;
+    size_t len = run->seg->length;
+    for (size_t skip = target + 1 - base; ; skip--) {
+        off += text_find_newline(text + off, len - off) + 1;
+        if (skip == 1) {
+            break;
+        }
+    }
+    *byte = run->byte_start + off;
+    return SUCCESS;
+}
+
+/**
+ * Copy bytes [start, start + len) of the committed document, clamped to 
+ * its end. The index finds the first segment in O(log n), then only the 
+ * segments the range touches are walked, so the cost follows len and not
+ * the document size. Returns NULL if start is past the end
+ */
+char *markdown_flatten_range(document *doc, size_t start, size_t len, 
+                             size_t *out_len) {
+    if (!doc) {
+        return NULL;
+    }
+    struct pos_index *index = get_pos_index(doc);
+    if (start > index->bytes) {
+        return NULL;
+    }
+    if (len > index->bytes - start) {
+        len = index->bytes - start;
+    }
+
+    char *buf = (char *)malloc(len + 1);
+    if (!buf) {
+        return NULL;
+    }
+    size_t copied = 0;
+    if (len > 0) {
+        size_t off = 0;
+        const text_segment *seg = index_seek(doc, start, &off);
+        while (copied < len) {
+            size_t take = seg->length - off;
+            if (take > len - copied) {
+                take = len - copied;
+            }
+            memcpy(buf + copied, seg->content + off, take);
+            copied += take;
+            seg = seg->next_segment;
+            off = 0;
+        }
+    }
+    buf[copied] = '\0';
+    if (out_len) {
+        *out_len = copied;
+    }
+    return buf;
+}
+
+/**
+ * Byte range covering lines [from, to) of the committed document, lines 
+ * counted from 0 and each including its newline. A to past the last 
+ * line runs to the end of the document
+ */
+int markdown_line_range(document *doc, size_t from, size_t to, 
+                        size_t *start, size_t *len) {
+    if (!doc || !start || !len || to < from) {
+        return INVALID_CURSOR_POS;
+    }
+    size_t first = 0;
+    if (markdown_offset_of_line(doc, from, &first) != SUCCESS) {
+        return INVALID_CURSOR_POS;
+    }
+    size_t end = 0;
+    if (markdown_offset_of_line(doc, to, &end) != SUCCESS) {
+        end = get_pos_index(doc)->bytes;
+    }
+    *start = first;
+    *len = end - first;
+    return SUCCESS;
+}
 
 // Helper functions: 
 
 /**
  * Copy committed list into working list for editing
- * All segments become COMMITTED_ORIGINAL state
+ * All segments become COMMITTED_ORIGINAL state. Only the segment headers
+ * are copied; both lists share the text
  */
 void sync_working(document *doc) {
     // Free any existing working list
-    free_segment_list(doc->working_head);
+    free_segment_list(doc, doc->working_head, 1);
     doc->working_head = NULL;
+    clear_finger(doc);
 
     // Clone committed list into working list
     text_segment **tail = &(doc->working_head);
     for (text_segment *n = doc->committed_head; n; n = n->next_segment) {
-        text_segment *copy = (text_segment *)malloc(sizeof(text_segment));
-        copy->length = n->length;
-        copy->content = (char *)malloc(n->length + 1);
-        memcpy(copy->content, n->content, n->length);
-        copy->content[n->length] = 0;           // Null terminate
-        copy->state = COMMITTED_ORIGINAL;       // All segments start as 
-                                               // original
-        copy->next_segment = NULL;
+        // All segments start as original
+        text_segment *copy = segment_new(doc, n->content, n->length, 
+                                         COMMITTED_ORIGINAL);
         *tail = copy;
         tail = &(copy->next_segment);
     }
 }
 
+/**
+ * Forget the finger; the nodes it pointed at are gone
+ */
+static void clear_finger(document *doc) {
+    doc->finger.prev = NULL;
+    doc->finger.seg = NULL;
+    doc->finger.seen = 0;
+}
+
+static void set_finger(document *doc, text_segment *prev, text_segment *seg, 
+                       size_t seen) {
+    doc->finger.prev = prev;
+    doc->finger.seg = seg;
+    doc->finger.seen = seen;
+}
+
+/**
+ * Pick where a walk for pos starts: at the finger if a walk from the head
+ * would pass through it, else at the head. Committed offsets of existing
+ * segments never change within a version, so the finger stays exact. 
+ * With before_inserts the walk stops at the first pending insertion at 
+ * pos, so the finger is only usable if none sit just before it
+ */
+static void walk_start(document *doc, size_t pos, int before_inserts, 
+                       text_segment **prev, text_segment **cur, 
+                       size_t *seen) {
+    const seg_finger *f = &doc->finger;
+    int usable = f->seg && (pos > f->seen || 
+        (pos == f->seen && (!before_inserts || !f->prev || 
+                            f->prev->state != PENDING_INS)));
+    *prev = usable ? f->prev : NULL;
+    *cur = usable ? f->seg : doc->working_head;
+    *seen = usable ? f->seen : doc->working_base;
+}
+
 /**
  * Find the segment and offset for a logical position in the working list
  * Used for cursor positioning in document operations
  */
 int find_cursor(document *doc, size_t pos, text_segment **out_line, 
                size_t *out_offset) {
+    text_segment *prev = NULL;
+    text_segment *cur = NULL;
     size_t seen = 0;
-    text_segment *cur = doc->working_head;
+    walk_start(doc, pos, 0, &prev, &cur, &seen);
+    if (pos == seen) {
+        // A position at a segment start resolves to the end of the 
+        // segment before it, which the finger has already passed
+        cur = doc->working_head;
+        seen = doc->working_base;
+    }
 
     while (cur) {
         // Only count non-inserted segments for position calculation
@@ -655,6 +2245,56 @@ int find_cursor(document *doc, size_t pos, text_segment **out_line,
     return INVALID_CURSOR_POS;
 }
 
+/**
+ * Split the visible segment cur at offset off (0 < off < length). The 
+ * tail becomes a new segment right after it, sharing the same text
+ */
+static text_segment *split_segment(document *doc, text_segment *cur, 
+                                   size_t off) {
+    record_undo(doc, UNDO_SPLIT, cur, NULL, NULL, cur->length);
+    text_segment *tail = segment_new(doc, cur->content + off, 
+                                     cur->length - off, cur->state);
+    tail->next_segment = cur->next_segment;
+    segment_truncate(doc, cur, off);
+    cur->next_segment = tail;
+    return tail;
+}
+
+/**
+ * Make inserted text safe to point at. Short text is copied inline by 
+ * segment_new, so only longer text goes to the add buffer
+ */
+static const char *store_text(document *doc, const char *str, size_t len) {
+    return (len > SEG_INLINE_MAX) ? buffer_append(doc, str, len) : str;
+}
+
+/**
+ * Link a pending insertion of stored text between prev and cur, and leave
+ * the finger on it
+ */
+static void link_insertion(document *doc, text_segment *prev, 
+                           text_segment *cur, size_t seen, const char *text,
+                           size_t len) {
+    text_segment *ins = segment_new(doc, text, len, PENDING_INS);
+    link_chain(doc, prev, cur, seen, ins, ins);
+}
+
+/**
+ * Link the pending segments first..last between prev and cur, and leave
+ * the finger on the first
+ */
+static void link_chain(document *doc, text_segment *prev, text_segment *cur,
+                       size_t seen, text_segment *first, text_segment *last) {
+    record_undo(doc, UNDO_LINK, first, prev, last, 0);
+    last->next_segment = cur;
+    if (prev) {
+        prev->next_segment = first;
+    } else {
+        doc->working_head = first;
+    }
+    set_finger(doc, prev, first, seen);
+}
+
 /**
  * Insert text at specified position in working list
  * Handles position finding, node splitting, and insertion ordering
@@ -664,9 +2304,10 @@ int add_text(document *doc, size_t pos, const char *str) {
         sync_working(doc);
     }
 
-    text_segment *cur = doc->working_head;
+    text_segment *cur = NULL;
     text_segment *prev = NULL;
     size_t seen = 0;
+    walk_start(doc, pos, 0, &prev, &cur, &seen);
     
     // Step 1: Find the insertion position, counting only visible segments 
     // (non-PENDING_INS)
@@ -691,24 +2332,9 @@ int add_text(document *doc, size_t pos, const char *str) {
     // Step 2: If inserting in the middle of a visible node, split it
     if (cur && cur->state != PENDING_INS && pos > seen && 
         pos < seen + cur->length) {
-        size_t l1 = pos - seen;
-        size_t l2 = cur->length - l1;
-        
-        // Create second half of split node
-        text_segment *mid = (text_segment *)malloc(sizeof(text_segment));
-        mid->length = l2;
-        mid->content = (char *)malloc(l2 + 1);
-        memcpy(mid->content, cur->content + l1, l2);
-        mid->content[l2] = 0;
-        mid->state = cur->state;
-        mid->next_segment = cur->next_segment;
-
-        // Truncate first half
-        cur->length = l1;
-        cur->content[l1] = 0;
-        cur->next_segment = mid;
         prev = cur;
-        cur = mid;
+        cur = split_segment(doc, cur, pos - seen);
+        seen = pos;
     }
 
     // Step 3: Find the end of any existing insertions at this position
@@ -719,20 +2345,8 @@ int add_text(document *doc, size_t pos, const char *str) {
     }
 
     // Step 4: Insert new segment after existing insertions at same position
-    text_segment *ins = (text_segment *)malloc(sizeof(text_segment));
-    ins->length = strlen(str);
-    ins->content = (char *)malloc(ins->length + 1);
-    strcpy(ins->content, str);
-    ins->state = PENDING_INS;
-    ins->next_segment = cur;
-
-    // Link into list
-    if (prev) {
-        prev->next_segment = ins;
-    } else {
-        doc->working_head = ins;
-    }
-
+    size_t len = strlen(str);
+    link_insertion(doc, prev, cur, seen, store_text(doc, str, len), len);
     return SUCCESS;
 }
 
@@ -745,27 +2359,42 @@ int put_text(document *doc, size_t pos, const char *str) {
         sync_working(doc);
     }
 
-    // Validate position by counting total visible length
-    size_t total_length = 0;
-    text_segment *cur = doc->working_head;
-    while (cur) {
-        if (cur->state != PENDING_INS) {
-            total_length += cur->length;
-        }
-        cur = cur->next_segment;
-    }
-    
-    // Position must be within [0, total_length]
-    if (pos > total_length) {
+    // Position must be within [0, committed length]; edits never change 
+    // committed coordinates, so the index length is the visible length
+    if (pos > get_pos_index(doc)->bytes) {
         return INVALID_CURSOR_POS;
     }
 
-    cur = doc->working_head;
+    size_t len = strlen(str);
+    return put_stored(doc, pos, store_text(doc, str, len), len);
+}
+
+/**
+ * put_text for text already passed through store_text, so one stored 
+ * copy can back many insertions. pos must be valid
+ */
+static int put_stored(document *doc, size_t pos, const char *text, 
+                      size_t len) {
+    text_segment *ins = segment_new(doc, text, len, PENDING_INS);
+    put_chain(doc, pos, ins, ins);
+    return SUCCESS;
+}
+
+/**
+ * Link the pending segments first..last at pos, ahead of any insertions
+ * already there. pos must be valid
+ */
+static void put_chain(document *doc, size_t pos, text_segment *first, 
+                      text_segment *last) {
+    text_segment *cur = NULL;
     text_segment *prev = NULL;
     size_t seen = 0;
+    walk_start(doc, pos, 1, &prev, &cur, &seen);
     
-    // Find the insertion position, counting only visible segments
-    while (cur && seen + cur->length <= pos) {
+    // Find the insertion position, counting only visible segments. 
+    // Insertions before pos are passed; at pos the new text goes first
+    while (cur && (cur->state == PENDING_INS ? seen < pos 
+                                             : seen + cur->length <= pos)) {
         if (cur->state != PENDING_INS) {
             seen += cur->length;
         }
@@ -776,38 +2405,46 @@ int put_text(document *doc, size_t pos, const char *str) {
     // If inserting in the middle of a visible node, split it
     if (cur && cur->state != PENDING_INS && pos > seen && 
         pos < seen + cur->length) {
-        size_t l1 = pos - seen;
-        size_t l2 = cur->length - l1;
-        
-        text_segment *mid = (text_segment *)malloc(sizeof(text_segment));
-        mid->length = l2;
-        mid->content = (char *)malloc(l2 + 1);
-        memcpy(mid->content, cur->content + l1, l2);
-        mid->content[l2] = 0;
-        mid->state = cur->state;
-        mid->next_segment = cur->next_segment;
-
-        cur->length = l1;
-        cur->content[l1] = 0;
-        cur->next_segment = mid;
         prev = cur;
-        cur = mid;
+        cur = split_segment(doc, cur, pos - seen);
+        seen = pos;
     }
 
-    // Create and insert new segment
-    text_segment *ins = (text_segment *)malloc(sizeof(text_segment));
-    ins->length = strlen(str);
-    ins->content = (char *)malloc(ins->length + 1);
-    strcpy(ins->content, str);
-    ins->state = PENDING_INS;
-    ins->next_segment = cur;
+    link_chain(doc, prev, cur, seen, first, last);
+}
 
-    if (prev) {
-        prev->next_segment = ins;
-    } else {
-        doc->working_head = ins;
+/**
+ * Insert a copy of the committed range [start, start + len) at dest. The
+ * position index finds the first segment of the range in O(log n); the 
+ * copies point at the same immutable buffer text as the originals (short
+ * pieces are copied inline), so the cost is one header per segment in 
+ * the range, whatever its length in bytes. The range must be valid
+ */
+static int copy_range(document *doc, size_t start, size_t len, size_t dest) {
+    size_t off = 0;
+    const text_segment *n = (len > 0) ? index_seek(doc, start, &off) : NULL;
+
+    text_segment *first = NULL;
+    text_segment **tail = &first;
+    text_segment *last = NULL;
+    for (size_t remain = len; n && remain > 0; n = n->next_segment) {
+        size_t take = n->length - off;
+        if (take > remain) {
+            take = remain;
+        }
+        if (take > 0) {
+            last = segment_new(doc, n->content + off, take, PENDING_INS);
+            *tail = last;
+            tail = &last->next_segment;
+            remain -= take;
+        }
+        off = 0;
     }
 
+    if (!doc->working_head) {
+        sync_working(doc);
+    }
+    put_chain(doc, dest, first, last);
     return SUCCESS;
 }
 
@@ -820,9 +2457,11 @@ int remove_text(document *doc, size_t pos, size_t len) {
         sync_working(doc);
     }
     
+    text_segment *cur = NULL;
+    text_segment *prev = NULL;
     size_t seen = 0;
     size_t remain = len;
-    text_segment *cur = doc->working_head;
+    walk_start(doc, pos, 0, &prev, &cur, &seen);
 
     // Find starting node - count all visible segments (COMMITTED_ORIGINAL 
     // and PENDING_DEL)
@@ -830,8 +2469,13 @@ int remove_text(document *doc, size_t pos, size_t len) {
         if (cur->state != PENDING_INS) {
             seen += cur->length;
         }
+        prev = cur;
         cur = cur->next_segment;
     }
+    if (cur) {
+        // Splits below only add nodes after cur, so this stays valid
+        set_finger(doc, prev, cur, seen);
+    }
 
     // Process deletion across multiple segments
     while (cur && remain > 0) {
@@ -848,30 +2492,23 @@ int remove_text(document *doc, size_t pos, size_t len) {
 
         // If partial delete at end, split the segment after deletion point
         if (off + dellen < cur->length) {
-            text_segment *aft = (text_segment *)malloc(sizeof(text_segment));
-            aft->length = cur->length - (off + dellen);
-            aft->content = (char *)malloc(aft->length + 1);
-            memcpy(aft->content, cur->content + off + dellen, aft->length);
-            aft->content[aft->length] = 0;
-            aft->state = cur->state;
-            aft->next_segment = cur->next_segment;
-            cur->next_segment = aft;
+            split_segment(doc, cur, off + dellen);
         }
         
         // If partial delete at beginning, split the segment before deletion 
-        // point
+        // point and keep the deleted middle as its own PENDING_DEL segment
+        // so later positions in this version still line up
         if (off > 0) {
-            text_segment *aft = cur->next_segment;
-            cur->length = off;
-            cur->content[off] = 0;
-            cur = aft;
+            text_segment *del = split_segment(doc, cur, off);
+            segment_set_state(doc, del, PENDING_DEL);
+            cur = del->next_segment;
             seen += off + dellen;
             remain -= dellen;
             continue;
         }
         
         // Full node is in delete range - mark for deletion
-        cur->state = PENDING_DEL;
+        segment_set_state(doc, cur, PENDING_DEL);
         remain -= dellen;
         seen += dellen;
         cur = cur->next_segment;
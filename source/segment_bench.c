@@ -0,0 +1,95 @@
+#define _GNU_SOURCE  // For mallinfo2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include "../libs/markdown.h"
+
+/**
+ * Cost of a heavily fragmented document: a text with formatting markers
+ * and short inserts every few bytes, as many small edits leave it.
+ * Reports heap bytes per segment and the time to walk and flatten the
+ * committed list. Usage: segment_bench [thousands of edits]
+ */
+
+#define DEFAULT_KILO_EDITS 100
+#define EDIT_SPACING 8
+#define WALK_ROUNDS 20
+
+static volatile size_t sink;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t heap_in_use(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+int main(int argc, char **argv) {
+    size_t kilo = (argc > 1) ? (size_t)atoi(argv[1]) : DEFAULT_KILO_EDITS;
+    if (kilo == 0) {
+        kilo = DEFAULT_KILO_EDITS;
+    }
+    size_t edits = kilo * 1000;
+    size_t len = edits * EDIT_SPACING;
+
+    char *text = (char *)malloc(len + 1);
+    for (size_t i = 0; i < len; i++) {
+        text[i] = (i % 64 == 63) ? '\n' : (char)('a' + i % 26);
+    }
+    text[len] = 0;
+
+    size_t heap_before = heap_in_use();
+    document *doc = markdown_init();
+    markdown_insert(doc, doc->current_version, 0, text);
+    markdown_increment_version(doc);
+
+    // One version of ascending edits: markers, a typed character, a word
+    static const char *inserts[] = {"**", "x", "> ", "word"};
+    for (size_t i = 0; i < edits; i++) {
+        markdown_insert(doc, doc->current_version, i * EDIT_SPACING,
+                        inserts[i % 4]);
+    }
+    markdown_increment_version(doc);
+
+    md_stats stats;
+    markdown_stats(doc, &stats);
+    size_t segments = stats.committed_segments;
+    size_t heap = heap_in_use() - heap_before;
+
+    // Touch every node and its first byte, as position walks do
+    double start = now_sec();
+    for (int r = 0; r < WALK_ROUNDS; r++) {
+        const text_segment *n = doc->committed_head;
+        for (; n; n = n->next_segment) {
+            sink += (size_t)(unsigned char)n->content[0] + n->length;
+        }
+    }
+    double walk = (now_sec() - start) / WALK_ROUNDS;
+
+    start = now_sec();
+    for (int r = 0; r < WALK_ROUNDS; r++) {
+        char *flat = markdown_flatten(doc);
+        sink += (size_t)flat[0];
+        free(flat);
+    }
+    double flatten = (now_sec() - start) / WALK_ROUNDS;
+
+    printf("segment benchmark, %zu segments, %zu bytes of text\n", segments,
+           stats.content_bytes);
+    printf("heap bytes per segment  %8.1f (%.1f beyond the text)\n", 
+           (double)heap / segments, 
+           (double)(heap - stats.content_bytes) / segments);
+    printf("walk                    %8.2f ns/segment\n",
+           walk * 1e9 / segments);
+    printf("flatten                 %8.2f ms\n", flatten * 1e3);
+
+    markdown_free(doc);
+    free(text);
+    return 0;
+}
@@ -11,39 +11,114 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <limits.h>
 #include <time.h>
+#include <stdarg.h>
+#include <sched.h>
 #include "markdown.h"
 #include "document.h"
+#include "io_backend.h"
+#include "timer_wheel.h"
+#include "lz.h"
+#include "http.h"
+#include "json.h"
+#include "store.h"
 
 #define MAX_CLIENTS 100
 #define MAX_CMD_LEN 256
+#define MAX_TXN_EDITS 64
+#define DEFAULT_QUEUE_MAX 10000
+#define DEFAULT_CLIENT_QUEUE_MAX 1000
+#define FAIR_QUANTUM 1          // Edits a user's deficit grows by per round
+#define MAX_SHARDS 16
+#define SHARD_MIN_RUN 64        // Shorter runs are applied on one thread
+#define SHARD_MAX_RUN 4096      // Keeps --batch-budget-ms checks frequent
+#define MAX_MULTI_POSITIONS 128 // More than fit in one command
 #define MAX_USERNAME_LEN 128
 #define MAX_ROLE_LEN 16
-#define MAX_LOG_LEN 10000
+#define INITIAL_BUFFER_LEN 1024
 #define FIFO_PERMISSIONS 0666
 #define SLEEP_INTERVAL_SEC 1
 #define AUTH_DELAY_SEC 1
 #define BROADCAST_INTERVAL_MULTIPLIER 1000
+#define DEFAULT_PRESENCE_INTERVAL_MS 50
+#define MAX_PRESENCE_LEN (MAX_CLIENTS * (MAX_USERNAME_LEN + 32) + 32)
+#define FOLLOWER_USERNAME "@follower"
+#define FOLLOWER_ROLE "follower"
+#define MAX_LINE_LEN 1024
+#define LEADER_HANDSHAKE_TIMEOUT_SEC 1
+#define DEFAULT_IDLE_TIMEOUT_SEC 30
+#define TIMER_TICK_MS 100
+#define TICKS_PER_SEC (1000 / TIMER_TICK_MS)
+#define LEADER_HEARTBEAT_SEC 5
+#define COMPRESS_MIN_BYTES 512
+#define DEFAULT_HTTP_ADDR "127.0.0.1"
+
+// Command queue node
+typedef struct command_node {
+    char command[MAX_CMD_LEN];
+    char username[MAX_USERNAME_LEN];
+    int utf8;        // Positions are code points, translated at apply time
+    int txn_len;     // Edits in the transaction this node opens, else 0
+    int slot;        // Submitting client, or -1 outside the per-client quota
+    const char *stale; // Rejection for an edit that could not be rebased
+    struct timespec timestamp;
+    struct command_node *next;
+} command_node_t;
 
 // Client connection structure
 typedef struct {
     pid_t client_pid;
     char username[MAX_USERNAME_LEN];
     int write_fd;  // Server writes to client
+    int presence_fd; // Same FIFO opened non-blocking, for PRESENCE frames
     int read_fd;   // Server reads from client
     char role[MAX_ROLE_LEN];
     int permission;  // 0 = read, 1 = write
     int active;      // 1 = connected, 0 = free slot
+    int is_follower; // 1 = replica server, may FORWARD for its users
+    int compress;    // 1 = opted in to compressed VERSION frames
+    int utf8_positions; // 1 = edit positions are UTF-8 code points
     pthread_t thread;
+    size_t cursor_pos;   // Latest reported cursor, committed coordinates
+    int cursor_set;      // 1 once the client has sent a CURSOR
+    int cursor_dirty;    // 1 if cursor changed since last presence frame
+    int view_set;        // 1 while the client watches a VIEW range
+    size_t view_start;   // Viewport, committed coordinates
+    size_t view_end;
+    size_t view_next_start; // Viewport once the batch being published 
+    size_t view_next_end;   // is committed
+    int txn_open;        // 1 between TXN_BEGIN and TXN_END
+    int txn_len;         // Edits held for the open transaction
+    int txn_aborted;     // 1 if the open transaction overflowed
+    command_node_t *txn_head; // Held edits, queued together at TXN_END
+    command_node_t *txn_tail;
 } client_t;
 
-// Command queue node
-typedef struct command_node {
-    char command[MAX_CMD_LEN];
-    char username[MAX_USERNAME_LEN];
-    struct timespec timestamp;
-    struct command_node *next;
-} command_node_t;
+// Growable text buffer for VERSION messages and the log
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} strbuf_t;
+
+// Parts of an "EDIT <user> <command> <result>" line, not NUL terminated
+typedef struct {
+    const char *user;
+    size_t user_len;
+    const char *command;
+    size_t command_len;
+    const char *result;
+    size_t result_len;
+} edit_line_t;
+
+// Buffered line reader over a FIFO
+typedef struct {
+    int fd;
+    char buf[4096];
+    size_t start;
+    size_t end;
+} line_reader_t;
 
 // Global state
 static document *doc = NULL;
@@ -53,40 +128,177 @@ static pthread_mutex_t doc_mutex = PTHREAD_MUTEX_INITIALIZER;
 static command_node_t *command_head = NULL;
 static command_node_t *command_tail = NULL;
 static pthread_mutex_t command_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Admission control, guarded by command_queue_mutex. A bound of 0 means
+// unbounded; followers and the HTTP gateway only count against the total
+static size_t queue_max = DEFAULT_QUEUE_MAX;
+static size_t client_queue_max = DEFAULT_CLIENT_QUEUE_MAX;
+static size_t queued_total = 0;
+static size_t queued_by_slot[MAX_CLIENTS];
+static uint64_t edits_accepted = 0;
+static uint64_t edits_rejected_busy = 0;
+static uint64_t edits_rejected_unauthorised = 0;
+static uint64_t edits_deferred = 0;
+
+// Batch scheduling, fixed at startup. batch_max caps the edits applied
+// in one version and batch_budget_ms the time spent applying them (0 = 
+// no limit); the overflow is committed as further versions in the same
+// cycle. fair_queuing drains per-user subqueues by deficit round-robin 
+// instead of taking edits in arrival order
+static size_t batch_max = 0;
+static int batch_budget_ms = 0;
+static int fair_queuing = 0;
+
+// Region shards the working list is cut into to apply a run of edits in
+// parallel; 1 applies every edit on the broadcast thread
+static int shard_count = 1;
+static uint64_t sharded_runs = 0;
+static uint64_t sharded_edits = 0;
 static volatile sig_atomic_t server_running = 1;
 static int broadcast_interval_ms = 1000;
-static char broadcast_log[MAX_LOG_LEN] = "";
+static strbuf_t broadcast_log = {NULL, 0, 0};
 static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int presence_interval_ms = DEFAULT_PRESENCE_INTERVAL_MS;
+static pthread_mutex_t presence_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Follower mode: replica of a leader on the same host
+static pid_t leader_pid = 0;
+static int leader_write_fd = -1;
+static int leader_read_fd = -1;
+static pthread_mutex_t leader_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Idle deadlines for every client slot, refreshed by any inbound line
+static int idle_timeout_sec = DEFAULT_IDLE_TIMEOUT_SEC;
+static timer_wheel idle_wheel;
+static timer_node idle_timers[MAX_CLIENTS];
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// HTTP/JSON gateway, off unless --http is given
+static int http_port = 0;
+static const char *http_addr = DEFAULT_HTTP_ADDR;
+
+// Durable version and audit history, off with --no-db
+static const char *store_path = STORE_DEFAULT_PATH;
 
 // Function declarations
 void handle_client_connection(int sig, siginfo_t *info, void *ctx);
 void *client_handler_thread(void *arg);
 void *stdin_command_thread(void *arg);
 void *broadcast_thread(void *arg);
+void *presence_thread(void *arg);
+void handle_cursor_command(int client_index, const char *command);
+void transform_cursors(void);
+void handle_view_command(int client_index, const char *command);
+void transform_views(void);
+void publish_version_message(const strbuf_t *version_message);
+static void strbuf_append(strbuf_t *buf, const char *text, size_t len);
+static void strbuf_printf(strbuf_t *buf, const char *fmt, ...);
+int connect_to_leader(pid_t pid);
+void *leader_reader_thread(void *arg);
+void forward_to_leader(const char *username, const char *command, 
+                       int utf8);
+void apply_edit_command(const char *command, char *result);
+static void apply_edit_to(document *target, const char *command, 
+                          char *result);
+void *reaper_thread(void *arg);
+void touch_client_deadline(int client_index);
+static uint64_t current_tick(void);
+static int read_line(line_reader_t *reader, char *out, size_t cap);
 int authenticate_client(const char *username, char *role, int *permission);
 void handle_immediate_command(int client_index, const char *command);
-void enqueue_edit_command(const char *username, const char *command);
+int enqueue_edit_command(int slot, const char *username, 
+                         const char *command, int utf8);
+static int is_write_command(const char *command);
+static int may_execute(const char *username, const char *command, 
+                       char *result);
+static void count_unauthorised(void);
+void reject_edit(int client_index, const char *username, 
+                 const char *reason);
+void begin_transaction(int client_index);
+void hold_transaction_edit(int client_index, const char *username, 
+                           const char *command, int utf8);
+void end_transaction(int client_index);
+static void replay_version_message(const char *version_message);
+static int translate_utf8_command(char *command, size_t cap);
+static int translate_line_command(char *command, size_t cap, int utf8);
+static void rebase_deferred(command_node_t *first);
 command_node_t *dequeue_command(void);
 void execute_queued_command(const char *username, const char *command, 
                            char *result);
 void cleanup_client_connection(int client_index);
 void save_document_to_file(void);
+void snapshot_document(void);
+void http_gateway(const http_request *req, http_response *resp, void *ctx);
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <TIME_INTERVAL_MS>\n", argv[0]);
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <TIME_INTERVAL_MS> [--presence-ms N] "
+                "[--follow LEADER_PID] [--no-io-uring] [--idle-timeout SEC] "
+                "[--http PORT] [--http-addr ADDR] [--db PATH | --no-db] "
+                "[--queue-max N] [--client-queue-max N] [--batch-max N] "
+                "[--batch-budget-ms N] [--fair] [--shards N]\n",
+                argv[0]);
         return EXIT_FAILURE;
     }
 
     broadcast_interval_ms = atoi(argv[1]);
+    int allow_uring = 1;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--presence-ms") == 0 && i + 1 < argc) {
+            presence_interval_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--follow") == 0 && i + 1 < argc) {
+            leader_pid = (pid_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-io-uring") == 0) {
+            allow_uring = 0;
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            idle_timeout_sec = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--http") == 0 && i + 1 < argc) {
+            http_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--http-addr") == 0 && i + 1 < argc) {
+            http_addr = argv[++i];
+        } else if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+            store_path = argv[++i];
+        } else if (strcmp(argv[i], "--no-db") == 0) {
+            store_path = NULL;
+        } else if (strcmp(argv[i], "--queue-max") == 0 && i + 1 < argc) {
+            queue_max = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--client-queue-max") == 0 && 
+                   i + 1 < argc) {
+            client_queue_max = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--batch-max") == 0 && i + 1 < argc) {
+            batch_max = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--batch-budget-ms") == 0 && 
+                   i + 1 < argc) {
+            batch_budget_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            shard_count = atoi(argv[++i]);
+            if (shard_count < 1) {
+                shard_count = 1;
+            } else if (shard_count > MAX_SHARDS) {
+                shard_count = MAX_SHARDS;
+            }
+        } else if (strcmp(argv[i], "--fair") == 0) {
+            fair_queuing = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
     printf("Server PID: %d\n", getpid());
+    io_backend_init(allow_uring);
+    printf("I/O backend: %s\n", io_backend_name());
     fflush(stdout);
 
     // Initialize document and client array
     doc = markdown_init();
     for (int i = 0; i < MAX_CLIENTS; i++) {
         clients[i].active = 0;
+        timer_node_init(&idle_timers[i], i);
     }
+    timer_wheel_init(&idle_wheel, current_tick());
+
+    // A client that vanishes must not kill the server mid-broadcast
+    signal(SIGPIPE, SIG_IGN);
 
     // Block SIGRTMIN+1 for all threads
     sigset_t block_set;
@@ -94,6 +306,23 @@ int main(int argc, char **argv) {
     sigaddset(&block_set, SIGRTMIN + 1);
     pthread_sigmask(SIG_BLOCK, &block_set, NULL);
 
+    // A follower joins its leader before accepting clients of its own
+    if (leader_pid > 0 && connect_to_leader(leader_pid) < 0) {
+        fprintf(stderr, "Failed to follow leader %d\n", leader_pid);
+        markdown_free(doc);
+        return EXIT_FAILURE;
+    }
+
+    // The leader owns the history; a follower's replica is not recorded
+    if (store_path && leader_pid == 0) {
+        if (store_open(store_path) < 0) {
+            fprintf(stderr, "History store disabled\n");
+        } else {
+            printf("History store: %s\n", store_path);
+            fflush(stdout);
+        }
+    }
+
     // Setup signal handler for client connections
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -108,8 +337,29 @@ int main(int argc, char **argv) {
     // Start background threads
     pthread_t stdin_thread;
     pthread_t broadcast_worker;
+    pthread_t presence_worker;
     pthread_create(&stdin_thread, NULL, stdin_command_thread, NULL);
     pthread_create(&broadcast_worker, NULL, broadcast_thread, NULL);
+    if (presence_interval_ms > 0) {
+        pthread_create(&presence_worker, NULL, presence_thread, NULL);
+    }
+    if (leader_pid > 0) {
+        pthread_t leader_worker;
+        pthread_create(&leader_worker, NULL, leader_reader_thread, NULL);
+    }
+    if (idle_timeout_sec > 0 || leader_pid > 0) {
+        pthread_t reaper_worker;
+        pthread_create(&reaper_worker, NULL, reaper_thread, NULL);
+    }
+    if (http_port > 0) {
+        if (http_server_start(http_addr, http_port, http_gateway, NULL) < 0) {
+            fprintf(stderr, "Failed to start HTTP gateway on %s:%d\n", 
+                    http_addr, http_port);
+        } else {
+            printf("HTTP gateway: http://%s:%d\n", http_addr, http_port);
+            fflush(stdout);
+        }
+    }
 
     // Main server loop - just wait for termination
     while (server_running) {
@@ -117,11 +367,15 @@ int main(int argc, char **argv) {
     }
 
     // Cleanup and save document before exit
+    http_server_stop();
     pthread_mutex_lock(&doc_mutex);
     save_document_to_file();
+    snapshot_document();
     pthread_mutex_unlock(&doc_mutex);
+    store_close();
     
     markdown_free(doc);
+    io_backend_shutdown();
     return EXIT_SUCCESS;
 }
 
@@ -184,6 +438,7 @@ void handle_client_connection(int sig, siginfo_t *info, void *ctx) {
 void *client_handler_thread(void *arg) {
     int client_index = (int)(intptr_t)arg;
     pid_t client_pid = clients[client_index].client_pid;
+    touch_client_deadline(client_index);
     
     // Build FIFO names
     char fifo_c2s[64];
@@ -207,23 +462,32 @@ void *client_handler_thread(void *arg) {
         return NULL;
     }
 
+    // Presence frames must never wait on a slow reader; a second open 
+    // of the FIFO gets its own non-blocking file description
+    int fd_presence = open(fifo_s2c, O_WRONLY | O_NONBLOCK);
+
+    pthread_mutex_lock(&clients_mutex);
     clients[client_index].read_fd = fd_read;
     clients[client_index].write_fd = fd_write;
+    clients[client_index].presence_fd = fd_presence;
+    pthread_mutex_unlock(&clients_mutex);
 
-    // Read and authenticate client
+    // Read and authenticate client. Several lines may arrive in one read 
+    // (e.g. a heartbeat right behind a command), so read line by line
+    line_reader_t reader = {.fd = fd_read};
     char username[MAX_USERNAME_LEN];
-    ssize_t bytes_read = read(fd_read, username, sizeof(username) - 1);
-    if (bytes_read <= 0) {
+    if (read_line(&reader, username, sizeof(username)) < 0) {
         perror("Failed to read username");
         goto cleanup;
     }
-    username[bytes_read] = '\0';
-    username[strcspn(username, "\n")] = '\0';
 
-    // Authenticate user
+    // Authenticate user; replica servers identify with a reserved name
     char role[MAX_ROLE_LEN];
     int permission = 0;
-    if (!authenticate_client(username, role, &permission)) {
+    if (strcmp(username, FOLLOWER_USERNAME) == 0) {
+        strcpy(role, FOLLOWER_ROLE);
+        clients[client_index].is_follower = 1;
+    } else if (!authenticate_client(username, role, &permission)) {
         dprintf(fd_write, "Reject UNAUTHORISED\n");
         sleep(AUTH_DELAY_SEC);  // Brief delay as per spec
         goto cleanup;
@@ -242,8 +506,8 @@ void *client_handler_thread(void *arg) {
     // Send document version and content
     pthread_mutex_lock(&doc_mutex);
     uint64_t version = doc->current_version;
-    char *doc_content = markdown_flatten(doc);
-    size_t doc_length = doc_content ? strlen(doc_content) : 0;
+    size_t doc_length = 0;
+    char *doc_content = markdown_flatten_checksum(doc, &doc_length, NULL);
     
     dprintf(fd_write, "%lu\n%zu\n", version, doc_length);
     if (doc_content && doc_length > 0) {
@@ -255,30 +519,105 @@ void *client_handler_thread(void *arg) {
     printf("Client connected: %s (%s)\n", username, role);
 
     // Command processing loop
-    char command[MAX_CMD_LEN];
+    char command[MAX_LINE_LEN];
     while (server_running && clients[client_index].active) {
-        bytes_read = read(fd_read, command, sizeof(command) - 1);
-        if (bytes_read <= 0) {
+        int len = read_line(&reader, command, sizeof(command));
+        if (len < 0) {
             break; // Client disconnected
         }
-        
-        command[bytes_read] = '\0';
-        command[strcspn(command, "\n")] = '\0';
+        touch_client_deadline(client_index);
 
+        if (strcmp(command, "HEARTBEAT") == 0) {
+            continue; // Only refreshes the idle deadline
+        }
         if (strcmp(command, "DISCONNECT") == 0) {
             printf("Client disconnecting: %s\n", username);
             break;
         }
+        // Queue nodes hold MAX_CMD_LEN bytes, and a cut edit would be 
+        // applied as different text. FORWARD lines are checked below
+        if (len >= MAX_CMD_LEN && !clients[client_index].is_follower) {
+            reject_edit(client_index, username, "TOO_LONG");
+            continue;
+        }
 
         // Handle different command types
         if (strcmp(command, "DOC?") == 0 || 
+            strncmp(command, "DOC? ", 5) == 0 || 
+            strncmp(command, "LINES? ", 7) == 0 || 
             strcmp(command, "PERM?") == 0 || 
-            strcmp(command, "LOG?") == 0) {
+            strcmp(command, "LOG?") == 0 || 
+            strcmp(command, "MEMSTATS?") == 0 || 
+            strcmp(command, "QSTATS?") == 0 || 
+            strncmp(command, "AUDIT?", 6) == 0) {
             // Immediate response commands
             handle_immediate_command(client_index, command);
+        } else if (strcmp(command, "COMPRESS ON") == 0 || 
+                   strcmp(command, "COMPRESS OFF") == 0) {
+            // Negotiate compressed VERSION frames for this client
+            pthread_mutex_lock(&clients_mutex);
+            clients[client_index].compress = (command[10] == 'N');
+            pthread_mutex_unlock(&clients_mutex);
+        } else if (strcmp(command, "POSMODE UTF8") == 0 || 
+                   strcmp(command, "POSMODE BYTE") == 0) {
+            // Choose how this client's edit positions are counted
+            clients[client_index].utf8_positions = (command[8] == 'U');
+        } else if (strncmp(command, "CURSOR ", 7) == 0) {
+            // Presence updates never enter the edit queue
+            handle_cursor_command(client_index, command);
+        } else if (strncmp(command, "VIEW ", 5) == 0 && 
+                   !clients[client_index].is_follower) {
+            // Followers replay every edit, so they always get them all
+            handle_view_command(client_index, command);
+        } else if (clients[client_index].is_follower && 
+                   strncmp(command, "FORWARD ", 8) == 0) {
+            // Edit submitted to a follower on behalf of one of its users,
+            // optionally tagged with the user's position mode
+            char fwd_user[MAX_USERNAME_LEN];
+            int offset = 0;
+            if (sscanf(command, "FORWARD %127s %n", fwd_user, &offset) == 1 &&
+                offset > 0) {
+                const char *fwd_cmd = command + offset;
+                int utf8 = (strncmp(fwd_cmd, "UTF8 ", 5) == 0);
+                fwd_cmd += utf8 ? 5 : 0;
+                if (strlen(fwd_cmd) >= MAX_CMD_LEN) {
+                    reject_edit(client_index, fwd_user, "TOO_LONG");
+                } else if (strcmp(fwd_cmd, "TXN_BEGIN") == 0) {
+                    begin_transaction(client_index);
+                } else if (strcmp(fwd_cmd, "TXN_END") == 0) {
+                    end_transaction(client_index);
+                } else if (clients[client_index].txn_open) {
+                    hold_transaction_edit(client_index, fwd_user, fwd_cmd,
+                                          utf8);
+                } else if (enqueue_edit_command(-1, fwd_user, fwd_cmd, 
+                                                utf8) < 0) {
+                    reject_edit(client_index, fwd_user, "BUSY");
+                }
+            }
+        } else if (!clients[client_index].permission && 
+                   is_write_command(command)) {
+            // Refused before it takes queue space or reaches the leader
+            count_unauthorised();
+            reject_edit(client_index, username, "UNAUTHORISED");
+        } else if (strcmp(command, "TXN_BEGIN") == 0) {
+            begin_transaction(client_index);
+        } else if (strcmp(command, "TXN_END") == 0) {
+            end_transaction(client_index);
+        } else if (clients[client_index].txn_open) {
+            // Held until TXN_END, then queued or forwarded as one unit
+            hold_transaction_edit(client_index, username, command, 
+                                  clients[client_index].utf8_positions);
+        } else if (leader_pid > 0) {
+            // Followers hold a read-only replica; the leader orders writes
+            forward_to_leader(username, command, 
+                              clients[client_index].utf8_positions);
         } else {
             // Edit commands - queue for batch processing
-            enqueue_edit_command(username, command);
+            if (enqueue_edit_command(client_index, username, command, 
+                                     clients[client_index].utf8_positions) 
+                < 0) {
+                reject_edit(client_index, username, "BUSY");
+            }
         }
     }
 
@@ -298,6 +637,63 @@ cleanup:
     return NULL;
 }
 
+// Write one stored edit as "<version> <user> <command> <result>"
+static void write_audit_line(uint64_t version, const char *username, 
+                             const char *command, const char *result, 
+                             void *ctx) {
+    dprintf(*(int *)ctx, "%lu %s %s %s\n", version, username, command, 
+            result);
+}
+
+// AUDIT? [user|*] [from] [to]: edits of this run from the history store
+static void handle_audit_command(int fd_write, const char *command) {
+    char user[MAX_USERNAME_LEN] = "*";
+    unsigned long from = 0;
+    unsigned long to = UINT64_MAX;
+    sscanf(command, "AUDIT? %127s %lu %lu", user, &from, &to);
+
+    dprintf(fd_write, "AUDIT?\n");
+    if (!store_is_open()) {
+        dprintf(fd_write, "Reject NO_STORE\n");
+    } else {
+        store_query_edits(strcmp(user, "*") == 0 ? NULL : user, from, to, 
+                          write_audit_line, &fd_write);
+    }
+    dprintf(fd_write, "END\n");
+}
+
+// DOC? <start> <len> and LINES? <from> <to>: send just that part of the
+// committed document as "<cmd> <byte start> <byte len>", the text and a 
+// newline. Only the segments in range are copied
+static void handle_range_read(int fd_write, const char *command) {
+    int lines = (strncmp(command, "LINES?", 6) == 0);
+    const char *name = lines ? "LINES?" : "DOC?";
+    size_t a = 0;
+    size_t b = 0;
+    if (sscanf(command + strlen(name), " %zu %zu", &a, &b) != 2) {
+        dprintf(fd_write, "%s\nReject INVALID_POSITION\n", name);
+        return;
+    }
+
+    pthread_mutex_lock(&doc_mutex);
+    size_t start = a;
+    size_t len = b;
+    char *text = NULL;
+    if (!lines || markdown_line_range(doc, a, b, &start, &len) == SUCCESS) {
+        text = markdown_flatten_range(doc, start, len, &len);
+    }
+    pthread_mutex_unlock(&doc_mutex);
+
+    if (!text) {
+        dprintf(fd_write, "%s\nReject INVALID_POSITION\n", name);
+        return;
+    }
+    dprintf(fd_write, "%s %zu %zu\n", name, start, len);
+    io_backend_fanout(&fd_write, 1, text, len);
+    dprintf(fd_write, "\n");
+    free(text);
+}
+
 // Handle commands that require immediate response
 void handle_immediate_command(int client_index, const char *command) {
     int fd_write = clients[client_index].write_fd;
@@ -309,40 +705,455 @@ void handle_immediate_command(int client_index, const char *command) {
         free(content);
         pthread_mutex_unlock(&doc_mutex);
     } 
+    else if (strncmp(command, "DOC? ", 5) == 0 || 
+             strncmp(command, "LINES? ", 7) == 0) {
+        handle_range_read(fd_write, command);
+    }
     else if (strcmp(command, "PERM?") == 0) {
         dprintf(fd_write, "PERM?\n%s\n", clients[client_index].role);
     } 
     else if (strcmp(command, "LOG?") == 0) {
         pthread_mutex_lock(&log_mutex);
-        dprintf(fd_write, "LOG?\n%s", broadcast_log);
+        dprintf(fd_write, "LOG?\n%s", 
+                broadcast_log.data ? broadcast_log.data : "");
         pthread_mutex_unlock(&log_mutex);
     }
+    else if (strncmp(command, "AUDIT?", 6) == 0) {
+        handle_audit_command(fd_write, command);
+    }
+    else if (strcmp(command, "QSTATS?") == 0) {
+        pthread_mutex_lock(&doc_mutex);
+        uint64_t runs = sharded_runs;
+        uint64_t runs_edits = sharded_edits;
+        pthread_mutex_unlock(&doc_mutex);
+        pthread_mutex_lock(&command_queue_mutex);
+        dprintf(fd_write, 
+                "QSTATS?\n"
+                "queued %zu\n"
+                "queued_by_you %zu\n"
+                "queue_max %zu\n"
+                "client_queue_max %zu\n"
+                "accepted %lu\n"
+                "rejected_busy %lu\n"
+                "rejected_unauthorised %lu\n"
+                "batch_max %zu\n"
+                "batch_budget_ms %d\n"
+                "fair %d\n"
+                "deferred %lu\n"
+                "shards %d\n"
+                "sharded_runs %lu\n"
+                "sharded_edits %lu\n"
+                "END\n",
+                queued_total, queued_by_slot[client_index], queue_max, 
+                client_queue_max, edits_accepted, edits_rejected_busy, 
+                edits_rejected_unauthorised, batch_max, batch_budget_ms, 
+                fair_queuing, edits_deferred, shard_count, runs, runs_edits);
+        pthread_mutex_unlock(&command_queue_mutex);
+    }
+    else if (strcmp(command, "MEMSTATS?") == 0) {
+        md_stats stats;
+        pthread_mutex_lock(&doc_mutex);
+        uint64_t version = doc->current_version;
+        markdown_stats(doc, &stats);
+        pthread_mutex_unlock(&doc_mutex);
+        dprintf(fd_write, 
+                "MEMSTATS?\n"
+                "version %lu\n"
+                "segments_committed %zu\n"
+                "segments_pending_ins %zu\n"
+                "segments_pending_del %zu\n"
+                "committed_list_segments %zu\n"
+                "working_list_segments %zu\n"
+                "content_bytes %zu\n"
+                "content_alloc_bytes %zu\n"
+                "buffer_bytes %zu\n"
+                "working_bytes %zu\n"
+                "overhead_bytes %zu\n"
+                "fragmentation %.4f\n"
+                "END\n",
+                version, stats.segments[COMMITTED_ORIGINAL], 
+                stats.segments[PENDING_INS], stats.segments[PENDING_DEL],
+                stats.committed_segments, stats.working_segments, 
+                stats.content_bytes, stats.content_alloc_bytes, 
+                stats.buffer_bytes, stats.working_bytes, stats.overhead_bytes, 
+                stats.fragmentation);
+    }
+}
+
+// Record the latest cursor position for a client, replacing any 
+// position not yet fanned out
+void handle_cursor_command(int client_index, const char *command) {
+    size_t pos = 0;
+    if (sscanf(command, "CURSOR %zu", &pos) != 1) {
+        return;
+    }
+
+    pthread_mutex_lock(&presence_mutex);
+    clients[client_index].cursor_pos = pos;
+    clients[client_index].cursor_set = 1;
+    clients[client_index].cursor_dirty = 1;
+    pthread_mutex_unlock(&presence_mutex);
+}
+
+// Carry every known cursor through the pending batch so positions stay
+// attached to the same text. Caller holds doc_mutex, before commit
+void transform_cursors(void) {
+    pthread_mutex_lock(&presence_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!clients[i].active || !clients[i].cursor_set) {
+            continue;
+        }
+        size_t pos = markdown_transform_position(doc, clients[i].cursor_pos);
+        if (pos != clients[i].cursor_pos) {
+            clients[i].cursor_pos = pos;
+            clients[i].cursor_dirty = 1;
+        }
+    }
+    pthread_mutex_unlock(&presence_mutex);
+}
+
+// VIEW <start> <end>: from the next version on, send this client full 
+// EDIT lines only for edits that touch the range. VIEW OFF clears it
+void handle_view_command(int client_index, const char *command) {
+    size_t start = 0;
+    size_t end = 0;
+    int off = (strcmp(command, "VIEW OFF") == 0);
+    if (!off && (sscanf(command, "VIEW %zu %zu", &start, &end) != 2 || 
+                 end < start)) {
+        return;
+    }
+
+    // doc_mutex keeps the change between versions: transform_views and 
+    // publish_version_message run under it for the same batch
+    pthread_mutex_lock(&doc_mutex);
+    pthread_mutex_lock(&clients_mutex);
+    clients[client_index].view_set = !off;
+    clients[client_index].view_start = start;
+    clients[client_index].view_end = end;
+    clients[client_index].view_next_start = start;
+    clients[client_index].view_next_end = end;
+    pthread_mutex_unlock(&clients_mutex);
+    pthread_mutex_unlock(&doc_mutex);
+}
+
+// Work out where every viewport sits once the pending batch is 
+// committed; publish_version_message still filters the batch by the old
+// range. Caller holds doc_mutex, before commit
+void transform_views(void) {
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active && clients[i].view_set) {
+            clients[i].view_next_start = 
+                markdown_transform_position(doc, clients[i].view_start);
+            clients[i].view_next_end = 
+                markdown_transform_position(doc, clients[i].view_end);
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// PRESENCE frames cut to at most PIPE_BUF bytes each, back to back. A 
+// non-blocking pipe write of that size goes through whole or not at all
+typedef struct {
+    char data[2 * MAX_PRESENCE_LEN];
+    size_t len;
+    size_t ends[MAX_CLIENTS]; // End of each finished frame
+    size_t count;
+    int lines;                // CURSOR lines in the frame being filled
+} presence_frames_t;
+
+static void presence_close_frame(presence_frames_t *frames) {
+    if (frames->lines > 0) {
+        memcpy(frames->data + frames->len, "END\n", 4);
+        frames->len += 4;
+        frames->ends[frames->count++] = frames->len;
+        frames->lines = 0;
+    }
+}
+
+static void presence_add(presence_frames_t *frames, const char *username, 
+                         size_t pos) {
+    char line[MAX_USERNAME_LEN + 32];
+    size_t n = (size_t)snprintf(line, sizeof(line), "CURSOR %s %zu\n", 
+                                username, pos);
+    size_t frame_start = frames->count ? frames->ends[frames->count - 1] : 0;
+    if (frames->lines > 0 && frames->len + n + 4 - frame_start > PIPE_BUF) {
+        presence_close_frame(frames);
+        frame_start = frames->len;
+    }
+    if (frames->lines == 0) {
+        memcpy(frames->data + frames->len, "PRESENCE\n", 9);
+        frames->len += 9;
+    }
+    memcpy(frames->data + frames->len, line, n);
+    frames->len += n;
+    frames->lines++;
+}
+
+// Write the frames to client i without blocking. Returns 0 if its pipe 
+// was full and the rest were dropped. Caller holds clients_mutex
+static int presence_send(int i, const presence_frames_t *frames) {
+    int fd = clients[i].presence_fd;
+    size_t start = 0;
+    for (size_t f = 0; f < frames->count; f++) {
+        size_t len = frames->ends[f] - start;
+        if (write(fd, frames->data + start, len) != (ssize_t)len) {
+            return 0;
+        }
+        start = frames->ends[f];
+    }
+    return 1;
+}
+
+// Send PRESENCE frames to every client. clients_mutex keeps them from 
+// landing inside a VERSION message, and is only held for non-blocking 
+// writes. A client that misses a frame gets every known cursor at the 
+// next one, if missed is given
+static void presence_fanout(const presence_frames_t *changed, 
+                            const presence_frames_t *all, int *missed) {
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!clients[i].active || clients[i].presence_fd <= 0) {
+            continue;
+        }
+        int resync = missed && missed[i];
+        int sent = presence_send(i, resync ? all : changed);
+        if (missed) {
+            missed[i] = !sent;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Background thread that fans out coalesced cursor positions. It never
+// takes doc_mutex and never blocks on a client's pipe, so presence 
+// traffic cannot hold up a commit
+void *presence_thread(void *arg) {
+    (void)arg;
+    static presence_frames_t changed;
+    static presence_frames_t all;
+    static int missed[MAX_CLIENTS];
+    
+    while (server_running) {
+        usleep(presence_interval_ms * BROADCAST_INTERVAL_MULTIPLIER);
+
+        int resync = 0;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            resync |= missed[i];
+        }
+
+        // Collect only cursors that moved since the last frame, and every
+        // cursor if some client has to catch up
+        changed.len = changed.count = 0;
+        all.len = all.count = 0;
+        pthread_mutex_lock(&presence_mutex);
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (!clients[i].active) {
+                continue;
+            }
+            if (clients[i].cursor_dirty) {
+                presence_add(&changed, clients[i].username, 
+                             clients[i].cursor_pos);
+                clients[i].cursor_dirty = 0;
+            }
+            if (resync && clients[i].cursor_set) {
+                presence_add(&all, clients[i].username, 
+                             clients[i].cursor_pos);
+            }
+        }
+        pthread_mutex_unlock(&presence_mutex);
+        presence_close_frame(&changed);
+        presence_close_frame(&all);
+
+        if (changed.count == 0 && !resync) {
+            continue;
+        }
+        presence_fanout(&changed, &all, missed);
+    }
+
+    return NULL;
 }
 
-// Add edit command to queue
-void enqueue_edit_command(const char *username, const char *command) {
+// Allocate a queue node for one edit
+static command_node_t *new_command_node(const char *username, 
+                                        const char *command, int utf8) {
     command_node_t *node = (command_node_t *)malloc(sizeof(command_node_t));
     if (!node) {
-        return;
+        return NULL;
     }
 
     strncpy(node->command, command, MAX_CMD_LEN - 1);
     node->command[MAX_CMD_LEN - 1] = '\0';
     strncpy(node->username, username, MAX_USERNAME_LEN - 1);
     node->username[MAX_USERNAME_LEN - 1] = '\0';
+    node->utf8 = utf8;
+    node->txn_len = 0;
+    node->slot = -1;
+    node->stale = NULL;
     clock_gettime(CLOCK_REALTIME, &node->timestamp);
     node->next = NULL;
+    return node;
+}
 
+// Append a linked run of count nodes to the queue in one step, so 
+// nothing queued by another thread can land inside it. slot is the 
+// submitting client, or -1 for sources without a per-client quota. 
+// Returns -1, queuing nothing, if the run would pass either bound
+static int enqueue_nodes(command_node_t *first, command_node_t *last, 
+                         size_t count, int slot) {
     pthread_mutex_lock(&command_queue_mutex);
+    if ((queue_max && queued_total + count > queue_max) || 
+        (slot >= 0 && client_queue_max && 
+         queued_by_slot[slot] + count > client_queue_max)) {
+        edits_rejected_busy += count;
+        pthread_mutex_unlock(&command_queue_mutex);
+        return -1;
+    }
     if (!command_tail) {
-        command_head = command_tail = node;
+        command_head = first;
     } else {
-        command_tail->next = node;
-        command_tail = node;
+        command_tail->next = first;
+    }
+    command_tail = last;
+    queued_total += count;
+    if (slot >= 0) {
+        queued_by_slot[slot] += count;
+    }
+    for (command_node_t *n = first; n; n = n->next) {
+        n->slot = slot;
+    }
+    edits_accepted += count;
+    pthread_mutex_unlock(&command_queue_mutex);
+    return 0;
+}
+
+// Add edit command to queue. Returns -1 if the queue is full (BUSY)
+int enqueue_edit_command(int slot, const char *username, 
+                         const char *command, int utf8) {
+    command_node_t *node = new_command_node(username, command, utf8);
+    if (!node) {
+        return -1;
     }
+    if (enqueue_nodes(node, node, 1, slot) < 0) {
+        free(node);
+        return -1;
+    }
+    return 0;
+}
+
+// Count an edit refused because its user is read-only
+static void count_unauthorised(void) {
+    pthread_mutex_lock(&command_queue_mutex);
+    edits_rejected_unauthorised++;
     pthread_mutex_unlock(&command_queue_mutex);
 }
 
+// Tell the submitter of an edit that was refused before it was queued. A
+// follower slot gets "REJECT <user> <reason>" to pass on to its user
+void reject_edit(int client_index, const char *username, 
+                 const char *reason) {
+    pthread_mutex_lock(&clients_mutex);
+    client_t *client = &clients[client_index];
+    if (client->is_follower) {
+        dprintf(client->write_fd, "REJECT %s %s\n", username, reason);
+    } else {
+        dprintf(client->write_fd, "Reject %s\n", reason);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Free the edits held for a slot's transaction and close it
+static void drop_transaction(client_t *client) {
+    command_node_t *node = client->txn_head;
+    while (node) {
+        command_node_t *next = node->next;
+        free(node);
+        node = next;
+    }
+    client->txn_head = client->txn_tail = NULL;
+    client->txn_len = 0;
+    client->txn_open = 0;
+    client->txn_aborted = 0;
+}
+
+// TXN_BEGIN: hold this slot's edits until TXN_END. A second TXN_BEGIN
+// inside an open transaction is ignored
+void begin_transaction(int client_index) {
+    client_t *client = &clients[client_index];
+    if (!client->txn_open) {
+        client->txn_open = 1;
+    }
+}
+
+// Hold one edit of the open transaction. An edit past MAX_TXN_EDITS 
+// abandons the whole transaction; the rest of it up to TXN_END is 
+// dropped and the client is told so
+void hold_transaction_edit(int client_index, const char *username, 
+                           const char *command, int utf8) {
+    client_t *client = &clients[client_index];
+    if (client->txn_aborted) {
+        return;
+    }
+    command_node_t *node = NULL;
+    if (client->txn_len < MAX_TXN_EDITS) {
+        node = new_command_node(username, command, utf8);
+    }
+    if (!node) {
+        drop_transaction(client);
+        client->txn_open = 1;
+        client->txn_aborted = 1;
+        reject_edit(client_index, username, "TXN_TOO_LARGE");
+        return;
+    }
+    if (client->txn_tail) {
+        client->txn_tail->next = node;
+    } else {
+        client->txn_head = node;
+    }
+    client->txn_tail = node;
+    client->txn_len++;
+}
+
+// Send a held transaction to the leader framed by TXN_BEGIN and TXN_END,
+// in one locked run so no other forwarded edit interleaves
+static void forward_transaction(const command_node_t *first) {
+    pthread_mutex_lock(&leader_mutex);
+    if (leader_write_fd >= 0) {
+        dprintf(leader_write_fd, "FORWARD %s TXN_BEGIN\n", first->username);
+        for (const command_node_t *n = first; n; n = n->next) {
+            dprintf(leader_write_fd, "FORWARD %s %s%s\n", n->username, 
+                    n->utf8 ? "UTF8 " : "", n->command);
+        }
+        dprintf(leader_write_fd, "FORWARD %s TXN_END\n", first->username);
+    }
+    pthread_mutex_unlock(&leader_mutex);
+}
+
+// TXN_END: queue the held edits as one unit, which the broadcast thread
+// applies back to back and all or nothing. Followers pass the unit on
+void end_transaction(int client_index) {
+    client_t *client = &clients[client_index];
+    if (!client->txn_open) {
+        return;
+    }
+    if (client->txn_head && !client->txn_aborted) {
+        if (leader_pid > 0) {
+            forward_transaction(client->txn_head);
+        } else {
+            client->txn_head->txn_len = client->txn_len;
+            if (enqueue_nodes(client->txn_head, client->txn_tail, 
+                              (size_t)client->txn_len, 
+                              client->is_follower ? -1 : client_index) < 0) {
+                reject_edit(client_index, client->txn_head->username, 
+                            "BUSY");
+            } else {
+                client->txn_head = client->txn_tail = NULL;
+            }
+        }
+    }
+    drop_transaction(client);
+}
+
 // Remove and return next command from queue
 command_node_t *dequeue_command(void) {
     if (!command_head) {
@@ -358,81 +1169,1267 @@ command_node_t *dequeue_command(void) {
     return node;
 }
 
-// Background thread that processes command queue and broadcasts updates
-void *broadcast_thread(void *arg) {
-    (void)arg;
-    
-    while (server_running) {
-        // Convert ms to microseconds
-        usleep(broadcast_interval_ms * BROADCAST_INTERVAL_MULTIPLIER); 
-        
-        // Check if there are commands to process
-        pthread_mutex_lock(&command_queue_mutex);
-        if (!command_head) {
-            pthread_mutex_unlock(&command_queue_mutex);
-            continue;
-        }
+// Rewrite a queued edit in byte positions of the committed document. A
+// translated edit is left in byte form, so translating it again is 
+// harmless. Returns -1 if a position is not in the document. Caller 
+// holds doc_mutex
+static int translate_queued_command(command_node_t *cmd) {
+    int lc = translate_line_command(cmd->command, sizeof(cmd->command), 
+                                    cmd->utf8);
+    if (lc < 0 || (lc == 0 && cmd->utf8 && 
+        translate_utf8_command(cmd->command, sizeof(cmd->command)) < 0)) {
+        return -1;
+    }
+    cmd->utf8 = 0;
+    return 0;
+}
 
-        // Collect all commands from queue first
-        command_node_t *commands_to_process = command_head;
-        command_head = command_tail = NULL;
-        pthread_mutex_unlock(&command_queue_mutex);
+// Rewrite a queued edit in byte positions and check its user may run it.
+// Returns 1 if it is ready to apply, else the rejection is in result. 
+// Caller holds doc_mutex
+static int prepare_queued_command(command_node_t *cmd, char *result) {
+    if (cmd->stale) {
+        strcpy(result, cmd->stale);
+        return 0;
+    }
+    if (translate_queued_command(cmd) < 0) {
+        strcpy(result, "Reject INVALID_POSITION");
+        return 0;
+    }
+    return may_execute(cmd->username, cmd->command, result);
+}
 
-        // Now process all commands while holding doc mutex
-        pthread_mutex_lock(&doc_mutex);
-        uint64_t old_version = doc->current_version;
-        char version_message[MAX_LOG_LEN];
-        char temp_buffer[1024];
-        
-        snprintf(version_message, sizeof(version_message), 
-                "VERSION %lu\n", old_version + 1);
-
-        command_node_t *cmd = commands_to_process;
-        int commands_processed = 0;
-        while (cmd != NULL) {
-            char result[256];
-            execute_queued_command(cmd->username, cmd->command, result);
-            
-            snprintf(temp_buffer, sizeof(temp_buffer), 
-                    "EDIT %s %s %s\n", cmd->username, cmd->command, result);
-            strcat(version_message, temp_buffer);
-            
-            commands_processed++;
-            
-            command_node_t *next = cmd->next;
-            free(cmd);
-            cmd = next;
-        }
-        
-        strcat(version_message, "END\n");
+// Translate a queued edit to byte positions if needed and apply it. 
+// Caller holds doc_mutex
+static void run_queued_command(command_node_t *cmd, char *result) {
+    if (prepare_queued_command(cmd, result)) {
+        apply_edit_command(cmd->command, result);
+    }
+}
 
-        // Only increment version and broadcast if commands were processed
-        if (commands_processed > 0) {
-            markdown_increment_version(doc);
-            
-            // Update broadcast log
-            pthread_mutex_lock(&log_mutex);
-            strcat(broadcast_log, version_message);
-            pthread_mutex_unlock(&log_mutex);
-            
-            // Broadcast to all clients
-            pthread_mutex_lock(&clients_mutex);
-            for (int i = 0; i < MAX_CLIENTS; i++) {
-                if (clients[i].active) {
-                    write(clients[i].write_fd, version_message, 
-                          strlen(version_message));
-                }
-            }
-            pthread_mutex_unlock(&clients_mutex);
-        }
-        
-        pthread_mutex_unlock(&doc_mutex);
+// Record an applied edit in the batch's VERSION message and the store
+static void log_queued_command(const command_node_t *cmd, const char *result,
+                               strbuf_t *version_message, int stored) {
+    strbuf_printf(version_message, "EDIT %s %s %s\n", cmd->username, 
+                  cmd->command, result);
+    if (stored) {
+        store_record_edit(cmd->username, cmd->command, result);
     }
-    
-    return NULL;
 }
 
-// Thread to handle server stdin commands
+// Apply the txn_len edits of a transaction back to back. If one is 
+// rejected, the transaction's earlier edits are rolled back to the 
+// savepoint taken before it; that edit keeps its reason and the others 
+// are logged as TXN_ABORTED.
+// Frees the transaction's nodes and returns the node after it. Caller 
+// holds doc_mutex
+static command_node_t *apply_transaction(command_node_t *first, 
+                                         strbuf_t *version_message, 
+                                         int stored) {
+    int len = first->txn_len;
+    char results[MAX_TXN_EDITS][256];
+    int failed = -1;
+
+    // Only the transaction's own changes are undone on failure; edits 
+    // applied earlier in the batch stay as they are
+    markdown_savepoint(doc);
+    command_node_t *cmd = first;
+    for (int i = 0; i < len; i++, cmd = cmd->next) {
+        if (failed >= 0) {
+            strcpy(results[i], "Reject TXN_ABORTED");
+            continue;
+        }
+        run_queued_command(cmd, results[i]);
+        if (strcmp(results[i], "SUCCESS") != 0) {
+            failed = i;
+        }
+    }
+
+    if (failed >= 0) {
+        markdown_rollback(doc);
+        for (int i = 0; i < failed; i++) {
+            strcpy(results[i], "Reject TXN_ABORTED");
+        }
+    } else {
+        markdown_release(doc);
+    }
+
+    cmd = first;
+    for (int i = 0; i < len; i++) {
+        log_queued_command(cmd, results[i], version_message, stored);
+        command_node_t *next = cmd->next;
+        free(cmd);
+        cmd = next;
+    }
+    return cmd;
+}
+
+// Committed range [lo, hi) an edit touches, for edits that can be 
+// applied to one region shard: no shard may start strictly inside it. 
+// An insertion at p needs only p, so its range is [p, p + 1). Returns 0
+// for edits that read or change the document outside their positions
+// (HEADING, ORDERED_LIST, MOVE, COPY, REPLACE_ALL, MULTI_*)
+static int edit_span(const char *command, size_t *lo, size_t *hi) {
+    char cmd_type[32] = "";
+    size_t a = 0;
+    size_t b = 0;
+    sscanf(command, "%31s", cmd_type);
+    if (strcmp(cmd_type, "INSERT") == 0 || 
+        strcmp(cmd_type, "NEWLINE") == 0 || 
+        strcmp(cmd_type, "BLOCKQUOTE") == 0 || 
+        strcmp(cmd_type, "UNORDERED_LIST") == 0 || 
+        strcmp(cmd_type, "HORIZONTAL_RULE") == 0) {
+        if (sscanf(command, "%*s %zu", &a) != 1) {
+            return 0;
+        }
+        b = a;
+    } else if (strcmp(cmd_type, "DEL") == 0) {
+        if (sscanf(command, "DEL %zu %zu", &a, &b) != 2 || 
+            b > SIZE_MAX - 1 - a) {
+            return 0;
+        }
+        b = (b > 0) ? a + b - 1 : a;
+    } else if (strcmp(cmd_type, "BOLD") == 0 || 
+               strcmp(cmd_type, "ITALIC") == 0 || 
+               strcmp(cmd_type, "CODE") == 0 || 
+               strcmp(cmd_type, "LINK") == 0) {
+        if (sscanf(command, "%*s %zu %zu", &a, &b) != 2) {
+            return 0;
+        }
+        if (b < a) {
+            size_t t = a;
+            a = b;
+            b = t;
+        }
+    } else {
+        return 0;
+    }
+    if (b == SIZE_MAX) {
+        return 0;
+    }
+    *lo = a;
+    *hi = b + 1;
+    return 1;
+}
+
+// One edit of a sharded run
+typedef struct {
+    command_node_t *cmd;
+    size_t lo;
+    size_t hi;
+    size_t shard;      // SIZE_MAX if rejected before it was applied
+    char result[256];
+} shard_edit_t;
+
+// The edits one worker applies to its shard
+typedef struct {
+    md_shard *shard;
+    size_t index;
+    shard_edit_t *edits;
+    size_t count;
+} shard_worker_t;
+
+static void *shard_worker(void *arg) {
+    shard_worker_t *worker = (shard_worker_t *)arg;
+    for (size_t i = 0; i < worker->count; i++) {
+        shard_edit_t *edit = &worker->edits[i];
+        if (edit->shard == worker->index) {
+            apply_edit_to(&worker->shard->doc, edit->cmd->command, 
+                          edit->result);
+        }
+    }
+    return NULL;
+}
+
+static int compare_edit_lo(const void *a, const void *b) {
+    const shard_edit_t *x = *(const shard_edit_t *const *)a;
+    const shard_edit_t *y = *(const shard_edit_t *const *)b;
+    return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+// Choose up to shard_count - 1 cuts for the run so each shard gets about
+// the same number of edits. A cut is only placed where a new group of 
+// overlapping edit ranges starts, so every edit lies inside one shard. 
+// Returns the number of cuts
+static size_t choose_cuts(shard_edit_t *edits, size_t count, size_t *cuts) {
+    shard_edit_t **sorted = 
+        (shard_edit_t **)malloc(count * sizeof(shard_edit_t *));
+    if (!sorted) {
+        return 0;
+    }
+    size_t live = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (edits[i].shard != SIZE_MAX) {
+            sorted[live++] = &edits[i];
+        }
+    }
+    qsort(sorted, live, sizeof(shard_edit_t *), compare_edit_lo);
+
+    size_t per_shard = live / (size_t)shard_count + 1;
+    size_t cut_count = 0;
+    size_t reach = 0;      // End of the group of ranges so far
+    size_t since_cut = 0;
+    for (size_t i = 0; i < live && cut_count + 1 < (size_t)shard_count; 
+         i++) {
+        if (i > 0 && sorted[i]->lo >= reach && since_cut >= per_shard) {
+            cuts[cut_count++] = sorted[i]->lo;
+            since_cut = 0;
+        }
+        if (sorted[i]->hi > reach) {
+            reach = sorted[i]->hi;
+        }
+        since_cut++;
+    }
+    free(sorted);
+    return cut_count;
+}
+
+// Apply the run of consecutive edits at cmd that each stay inside one 
+// position range, and log them in order. The working list is cut into up
+// to shard_count region shards between the edits' ranges, each shard's 
+// edits are applied on their own thread, and the shards are joined 
+// again. Edits in different shards touch disjoint text, so the result 
+// is the one applying the run in order would give, and a follower 
+// replaying the VERSION message serially agrees. Returns the node after
+// the run with the number of edits in *applied, or cmd and 0 if cmd 
+// itself needs the whole document. Caller holds doc_mutex
+static command_node_t *apply_sharded_run(command_node_t *cmd, 
+                                         strbuf_t *version_message, 
+                                         int stored, size_t *applied) {
+    *applied = 0;
+    size_t len = 0;
+    for (command_node_t *n = cmd; n && n->txn_len == 0 && 
+         len < SHARD_MAX_RUN; n = n->next) {
+        len++;
+    }
+    shard_edit_t *edits = (shard_edit_t *)malloc(len * sizeof(shard_edit_t));
+    if (!edits) {
+        return cmd;
+    }
+
+    // Prepare edits in order until one needs the whole document; it is 
+    // left prepared for the caller
+    size_t count = 0;
+    size_t live = 0;
+    command_node_t *n = cmd;
+    for (; count < len; n = n->next) {
+        shard_edit_t *edit = &edits[count];
+        edit->cmd = n;
+        edit->shard = 0;
+        if (!prepare_queued_command(n, edit->result)) {
+            edit->shard = SIZE_MAX;
+        } else if (!edit_span(n->command, &edit->lo, &edit->hi)) {
+            break;
+        } else {
+            live++;
+        }
+        count++;
+    }
+    if (count == 0) {
+        free(edits);
+        return cmd;
+    }
+
+    size_t cuts[MAX_SHARDS];
+    size_t cut_count = (live >= SHARD_MIN_RUN) 
+                     ? choose_cuts(edits, count, cuts) : 0;
+    size_t shards_made = 0;
+    md_shard *shards = (cut_count > 0) 
+                     ? markdown_shards_split(doc, cuts, cut_count, 
+                                             &shards_made) 
+                     : NULL;
+
+    if (shards && shards_made > 1) {
+        // Route each edit to the shard holding its first position
+        for (size_t i = 0; i < count; i++) {
+            if (edits[i].shard == SIZE_MAX) {
+                continue;
+            }
+            size_t s = 0;
+            while (s + 1 < shards_made && edits[i].lo >= shards[s + 1].start) {
+                s++;
+            }
+            edits[i].shard = s;
+        }
+
+        shard_worker_t workers[MAX_SHARDS];
+        pthread_t threads[MAX_SHARDS];
+        int started[MAX_SHARDS] = {0};
+        for (size_t s = 0; s < shards_made; s++) {
+            workers[s] = (shard_worker_t){&shards[s], s, edits, count};
+            if (s > 0) {
+                started[s] = (pthread_create(&threads[s], NULL, shard_worker,
+                                             &workers[s]) == 0);
+            }
+        }
+        for (size_t s = 0; s < shards_made; s++) {
+            if (s == 0 || !started[s]) {
+                shard_worker(&workers[s]);
+            } else {
+                pthread_join(threads[s], NULL);
+            }
+        }
+        markdown_shards_join(doc, shards, shards_made);
+        sharded_runs++;
+        sharded_edits += count;
+    } else {
+        if (shards) {
+            markdown_shards_join(doc, shards, shards_made);
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (edits[i].shard != SIZE_MAX) {
+                apply_edit_command(edits[i].cmd->command, edits[i].result);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        log_queued_command(edits[i].cmd, edits[i].result, version_message, 
+                           stored);
+        free(edits[i].cmd);
+    }
+    free(edits);
+    *applied = count;
+    return n;
+}
+
+// One schedulable unit of the queue: a single edit or a whole 
+// transaction, which is never split across versions
+typedef struct {
+    command_node_t *first;
+    command_node_t *last;
+    size_t cost;          // Edits in the unit
+    size_t next_of_user;  // Next unit from the same user, or SIZE_MAX
+    int picked;
+} batch_unit_t;
+
+// A user's subqueue of units for deficit round-robin
+typedef struct {
+    const char *username;
+    size_t head;          // Oldest unit not yet picked, or SIZE_MAX
+    size_t tail;
+    size_t deficit;
+} fair_user_t;
+
+// Whether a unit of cost edits still fits in a batch of taken edits 
+// capped at cap. The first unit always fits, so an oversized transaction
+// still runs
+static int batch_has_room(size_t taken, size_t cost, size_t cap) {
+    return taken == 0 || taken + cost <= cap;
+}
+
+// Pick units in arrival order until the batch is full
+static size_t pick_fifo(batch_unit_t *units, size_t count, size_t cap, 
+                        size_t *order) {
+    size_t taken = 0;
+    size_t picked = 0;
+    for (size_t i = 0; 
+         i < count && batch_has_room(taken, units[i].cost, cap); i++) {
+        units[i].picked = 1;
+        order[picked++] = i;
+        taken += units[i].cost;
+    }
+    return picked;
+}
+
+// Pick units by deficit round-robin over per-user subqueues: each round 
+// every waiting user earns FAIR_QUANTUM edits of credit and spends it on
+// its oldest units, so a user flooding the queue gets the same share of
+// the batch as one sending a single edit. Returns the number picked, or
+// SIZE_MAX if out of memory
+static size_t pick_fair(batch_unit_t *units, size_t count, size_t cap, 
+                        size_t *order) {
+    fair_user_t *users = (fair_user_t *)malloc(count * sizeof(fair_user_t));
+    if (!users) {
+        return SIZE_MAX;
+    }
+
+    // Build the subqueues, users in order of their first queued edit
+    size_t user_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t u = 0;
+        while (u < user_count && 
+               strcmp(users[u].username, units[i].first->username) != 0) {
+            u++;
+        }
+        if (u == user_count) {
+            users[u].username = units[i].first->username;
+            users[u].head = i;
+            users[u].deficit = 0;
+            user_count++;
+        } else {
+            units[users[u].tail].next_of_user = i;
+        }
+        users[u].tail = i;
+    }
+
+    size_t taken = 0;
+    size_t picked = 0;
+    size_t waiting = user_count;
+    int full = 0;
+    while (!full && waiting > 0) {
+        for (size_t u = 0; u < user_count && !full; u++) {
+            fair_user_t *user = &users[u];
+            if (user->head == SIZE_MAX) {
+                continue;
+            }
+            user->deficit += FAIR_QUANTUM;
+            while (user->head != SIZE_MAX && 
+                   units[user->head].cost <= user->deficit) {
+                batch_unit_t *unit = &units[user->head];
+                if (!batch_has_room(taken, unit->cost, cap)) {
+                    full = 1;
+                    break;
+                }
+                unit->picked = 1;
+                order[picked++] = user->head;
+                taken += unit->cost;
+                user->deficit -= unit->cost;
+                user->head = unit->next_of_user;
+            }
+            if (user->head == SIZE_MAX) {
+                user->deficit = 0;
+                waiting--;
+            }
+        }
+    }
+    free(users);
+    return picked;
+}
+
+// Choose the next version's batch of at most cap edits from the detached
+// queue of queued edits. Returns the batch in the order it is to be 
+// applied and leaves the edits that did not make it in *rest, in arrival
+// order, for a later version
+static command_node_t *schedule_batch(command_node_t *queue, size_t queued,
+                                      size_t cap, command_node_t **rest, 
+                                      command_node_t **rest_tail) {
+    *rest = *rest_tail = NULL;
+    if (queued <= cap && !fair_queuing) {
+        return queue; // Everything, in arrival order
+    }
+
+    size_t count = 0;
+    for (command_node_t *n = queue; n; n = n->next) {
+        count++;
+    }
+    batch_unit_t *units = (batch_unit_t *)malloc(count * sizeof(batch_unit_t));
+    size_t *order = (size_t *)malloc(count * sizeof(size_t));
+    if (!units || !order) {
+        free(units);
+        free(order);
+        return queue;
+    }
+
+    // Split the queue into units
+    size_t unit_count = 0;
+    command_node_t *n = queue;
+    while (n) {
+        batch_unit_t *unit = &units[unit_count++];
+        unit->first = n;
+        unit->cost = n->txn_len > 0 ? (size_t)n->txn_len : 1;
+        for (size_t i = 1; i < unit->cost && n->next; i++) {
+            n = n->next;
+        }
+        unit->last = n;
+        unit->next_of_user = SIZE_MAX;
+        unit->picked = 0;
+        n = n->next;
+    }
+
+    size_t picked = fair_queuing ? pick_fair(units, unit_count, cap, order)
+                                 : pick_fifo(units, unit_count, cap, order);
+    if (picked == SIZE_MAX) {
+        picked = pick_fifo(units, unit_count, cap, order);
+    }
+
+    // Relink the picked units in pick order and the rest in arrival order
+    for (size_t i = 0; i < picked; i++) {
+        units[order[i]].last->next = 
+            i + 1 < picked ? units[order[i + 1]].first : NULL;
+    }
+    for (size_t i = 0; i < unit_count; i++) {
+        if (units[i].picked) {
+            continue;
+        }
+        if (*rest_tail) {
+            (*rest_tail)->next = units[i].first;
+        } else {
+            *rest = units[i].first;
+        }
+        *rest_tail = units[i].last;
+        units[i].last->next = NULL;
+    }
+
+    command_node_t *batch = units[order[0]].first;
+    free(units);
+    free(order);
+    return batch;
+}
+
+// Put a run of edits back at the front of the queue, ahead of anything 
+// queued meanwhile, counted against the admission bounds again when 
+// counted is set. Caller holds command_queue_mutex
+static void requeue_front(command_node_t *first, command_node_t *last, 
+                          int counted) {
+    for (command_node_t *n = first; n; n = n->next) {
+        edits_deferred++;
+        if (counted) {
+            queued_total++;
+            if (n->slot >= 0) {
+                queued_by_slot[n->slot]++;
+            }
+        }
+    }
+    last->next = command_head;
+    command_head = first;
+    if (!command_tail) {
+        command_tail = last;
+    }
+}
+
+// Take the next version's batch of at most limit edits off the queue 
+// (batch_max lowers the limit). Edits left over are handed back in *rest
+// for the caller to rebase and put back at the front of the queue; they 
+// stay counted against the admission bounds until taken
+static command_node_t *take_batch(size_t limit, command_node_t **rest, 
+                                  command_node_t **rest_tail) {
+    pthread_mutex_lock(&command_queue_mutex);
+    command_node_t *queue = command_head;
+    size_t queued = queued_total;
+    command_head = command_tail = NULL;
+    pthread_mutex_unlock(&command_queue_mutex);
+    *rest = *rest_tail = NULL;
+    if (!queue) {
+        return NULL;
+    }
+
+    size_t cap = (batch_max && batch_max < limit) ? batch_max : limit;
+    command_node_t *batch = schedule_batch(queue, queued, cap, rest, 
+                                           rest_tail);
+
+    pthread_mutex_lock(&command_queue_mutex);
+    for (command_node_t *n = batch; n; n = n->next) {
+        queued_total--;
+        if (n->slot >= 0) {
+            queued_by_slot[n->slot]--;
+        }
+    }
+    pthread_mutex_unlock(&command_queue_mutex);
+    return batch;
+}
+
+// Milliseconds elapsed since start on the monotonic clock
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + 
+           (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+// Apply, commit and broadcast one version of at most limit edits. Stops 
+// early once batch_budget_ms has been spent applying, after at least one 
+// edit or transaction. The unapplied edits are rebased through the 
+// version and put back at the front of the queue, ahead of the edits the
+// scheduler left for later. Returns the number of edits committed
+static size_t commit_batch(size_t limit) {
+    command_node_t *rest;
+    command_node_t *rest_tail;
+    command_node_t *cmd = take_batch(limit, &rest, &rest_tail);
+    if (!cmd) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&doc_mutex);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t old_version = doc->current_version;
+    strbuf_t version_message = {NULL, 0, 0};
+    
+    strbuf_printf(&version_message, "VERSION %lu\n", old_version + 1);
+
+    // Each version is one transaction in the history store
+    int stored = (store_begin_batch(old_version + 1) == 0);
+
+    size_t commands_processed = 0;
+    command_node_t *cut = NULL;   // Edits the budget left unapplied
+    command_node_t *cut_tail = NULL;
+    while (cmd != NULL) {
+        if (commands_processed > 0 && batch_budget_ms > 0 && 
+            elapsed_ms(&start) >= batch_budget_ms) {
+            cut = cut_tail = cmd;
+            while (cut_tail->next) {
+                cut_tail = cut_tail->next;
+            }
+            break;
+        }
+
+        if (cmd->txn_len > 0) {
+            commands_processed += (size_t)cmd->txn_len;
+            cmd = apply_transaction(cmd, &version_message, stored);
+            continue;
+        }
+
+        if (shard_count > 1) {
+            size_t run = 0;
+            cmd = apply_sharded_run(cmd, &version_message, stored, &run);
+            commands_processed += run;
+            if (run > 0) {
+                continue;
+            }
+        }
+
+        char result[256];
+        run_queued_command(cmd, result);
+        log_queued_command(cmd, result, &version_message, stored);
+        
+        commands_processed++;
+        
+        command_node_t *next = cmd->next;
+        free(cmd);
+        cmd = next;
+    }
+    
+    strbuf_printf(&version_message, "END\n");
+
+    // Only increment version and broadcast if commands were processed
+    if (commands_processed > 0) {
+        transform_cursors();
+        transform_views();
+        rebase_deferred(cut);
+        rebase_deferred(rest);
+        markdown_increment_version(doc);
+        publish_version_message(&version_message);
+    }
+    if (rest || cut) {
+        pthread_mutex_lock(&command_queue_mutex);
+        if (rest) {
+            requeue_front(rest, rest_tail, 0);
+        }
+        if (cut) {
+            requeue_front(cut, cut_tail, 1);
+        }
+        pthread_mutex_unlock(&command_queue_mutex);
+    }
+    if (stored) {
+        store_commit_batch();
+        if (doc->current_version % STORE_SNAPSHOT_INTERVAL == 0) {
+            snapshot_document();
+        }
+    }
+    
+    pthread_mutex_unlock(&doc_mutex);
+    free(version_message.data);
+    return commands_processed;
+}
+
+// Background thread that processes command queue and broadcasts updates.
+// The edits queued when a cycle starts are committed in as many versions
+// as the batch budgets need, releasing doc_mutex between them so queries
+// are not held up behind a burst; later edits wait for the next cycle
+void *broadcast_thread(void *arg) {
+    (void)arg;
+    
+    while (server_running) {
+        // Convert ms to microseconds
+        usleep(broadcast_interval_ms * BROADCAST_INTERVAL_MULTIPLIER); 
+        
+        pthread_mutex_lock(&command_queue_mutex);
+        size_t remaining = queued_total;
+        pthread_mutex_unlock(&command_queue_mutex);
+
+        while (remaining > 0 && server_running) {
+            size_t committed = commit_batch(remaining);
+            if (committed == 0) {
+                break;
+            }
+            remaining -= committed < remaining ? committed : remaining;
+            if (remaining > 0) {
+                sched_yield(); // Let waiting readers take doc_mutex
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+// Append bytes to a growable buffer, keeping it NUL terminated
+static void strbuf_append(strbuf_t *buf, const char *text, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : INITIAL_BUFFER_LEN;
+        while (buf->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        char *data = (char *)realloc(buf->data, cap);
+        if (!data) {
+            return;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, text, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+// Append formatted text to a growable buffer
+static void strbuf_printf(strbuf_t *buf, const char *fmt, ...) {
+    char small[INITIAL_BUFFER_LEN];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(small, sizeof(small), fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len < sizeof(small)) {
+        strbuf_append(buf, small, (size_t)len);
+        return;
+    }
+
+    char *large = (char *)malloc((size_t)len + 1);
+    if (!large) {
+        return;
+    }
+    va_start(args, fmt);
+    vsnprintf(large, (size_t)len + 1, fmt, args);
+    va_end(args);
+    strbuf_append(buf, large, (size_t)len);
+    free(large);
+}
+
+// Split an EDIT line of len bytes into its parts. Results carry no user
+// text, so the last match is the real one. Returns 0 if it has no user
+static int parse_edit_line(const char *line, size_t len, edit_line_t *out) {
+    const char *user = line + 5;
+    const char *end = line + len;
+    const char *space = memchr(user, ' ', (size_t)(end - user));
+    if (!space) {
+        return 0;
+    }
+    const char *command = space + 1;
+
+    const char *result = NULL;
+    if (end - command > 8 && strncmp(end - 8, " SUCCESS", 8) == 0) {
+        result = end - 7;
+    } else {
+        for (const char *p = end - 8; p >= command - 1; p--) {
+            if (strncmp(p, " Reject ", 8) == 0) {
+                result = p + 1;
+                break;
+            }
+        }
+    }
+
+    out->user = user;
+    out->user_len = (size_t)(space - user);
+    out->command = command;
+    out->command_len = result ? (size_t)(result - 1 - command) 
+                              : (size_t)(end - command);
+    out->result = result ? result : "";
+    out->result_len = result ? (size_t)(end - result) : 0;
+    return 1;
+}
+
+// 1 if an edit may read or change the committed range [start, end]. 
+// Edits without a bounded range (REPLACE_ALL, MULTI_*) always do
+static int edit_touches_view(const char *command, size_t start, 
+                             size_t end) {
+    size_t lo = 0;
+    size_t hi = 0;
+    size_t a = 0;
+    size_t b = 0;
+    size_t c = 0;
+    if (edit_span(command, &lo, &hi)) {
+        return lo <= end && hi > start;
+    }
+    if (sscanf(command, "HEADING %zu %zu", &a, &b) == 2) {
+        return b <= end && b + 1 > start;
+    }
+    if (sscanf(command, "ORDERED_LIST %zu", &a) == 1) {
+        return a <= end; // Renumbers the list items after it
+    }
+    if (sscanf(command, "MOVE %zu %zu %zu", &a, &b, &c) == 3 || 
+        sscanf(command, "COPY %zu %zu %zu", &a, &b, &c) == 3) {
+        return (a <= end && a + b > start) || (c <= end && c + 1 > start);
+    }
+    return 1;
+}
+
+// Write the part of a VERSION message one viewport subscriber sees: 
+// EDIT lines for edits that touch its old range or are its own, then 
+// "VIEW <start> <end> <omitted>" with the range in the new version's 
+// coordinates and how many edits were left out. Caller holds 
+// clients_mutex
+static void filter_version_message(const strbuf_t *version_message, 
+                                   const client_t *client, strbuf_t *out) {
+    size_t omitted = 0;
+    const char *line = version_message->data;
+    const char *data_end = line + version_message->len;
+    while (line < data_end) {
+        const char *eol = memchr(line, '\n', (size_t)(data_end - line));
+        size_t len = eol ? (size_t)(eol - line) : (size_t)(data_end - line);
+        edit_line_t edit;
+        if (strncmp(line, "END", 3) == 0 && len == 3) {
+            strbuf_printf(out, "VIEW %zu %zu %zu\n", client->view_next_start,
+                          client->view_next_end, omitted);
+        } else if (strncmp(line, "EDIT ", 5) == 0 && 
+                   parse_edit_line(line, len, &edit)) {
+            char command[MAX_CMD_LEN];
+            int own = (edit.user_len == strlen(client->username) && 
+                       strncmp(edit.user, client->username, 
+                               edit.user_len) == 0);
+            int touches = 1;
+            if (edit.command_len < sizeof(command)) {
+                memcpy(command, edit.command, edit.command_len);
+                command[edit.command_len] = '\0';
+                touches = edit_touches_view(command, client->view_start, 
+                                            client->view_end);
+            }
+            if (!own && !touches) {
+                omitted++;
+                line += len + 1;
+                continue;
+            }
+        }
+        strbuf_append(out, line, len);
+        strbuf_append(out, "\n", 1);
+        line += len + 1;
+    }
+}
+
+// Append a committed batch to the log and send it to every client. Large
+// batches are compressed once and the same frame goes to every client 
+// that opted in with COMPRESS ON. Clients watching a VIEW range get 
+// their own filtered copy, sent plain
+void publish_version_message(const strbuf_t *version_message) {
+    // Update broadcast log
+    pthread_mutex_lock(&log_mutex);
+    strbuf_append(&broadcast_log, version_message->data, 
+                  version_message->len);
+    pthread_mutex_unlock(&log_mutex);
+    
+    pthread_mutex_lock(&clients_mutex);
+    int plain_fds[MAX_CLIENTS];
+    int compressed_fds[MAX_CLIENTS];
+    size_t plain_count = 0;
+    size_t compressed_count = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        // Slots still in the handshake have no pipe yet
+        if (!clients[i].active || clients[i].write_fd <= 0) {
+            continue;
+        }
+        if (clients[i].view_set) {
+            strbuf_t filtered = {NULL, 0, 0};
+            filter_version_message(version_message, &clients[i], &filtered);
+            io_backend_fanout(&clients[i].write_fd, 1, filtered.data, 
+                              filtered.len);
+            free(filtered.data);
+            clients[i].view_start = clients[i].view_next_start;
+            clients[i].view_end = clients[i].view_next_end;
+        } else if (clients[i].compress) {
+            compressed_fds[compressed_count++] = clients[i].write_fd;
+        } else {
+            plain_fds[plain_count++] = clients[i].write_fd;
+        }
+    }
+
+    char *frame = NULL;
+    size_t frame_len = 0;
+    if (compressed_count > 0 && version_message->len >= COMPRESS_MIN_BYTES) {
+        // "ZVERSION <raw_len> <compressed_len>\n" then the LZ block
+        size_t bound = lz_compress_bound(version_message->len);
+        frame = (char *)malloc(bound + 64);
+        if (frame) {
+            char *block = frame + 64;
+            size_t block_len = lz_compress(version_message->data, 
+                                           version_message->len, 
+                                           block, bound);
+            if (block_len > 0 && block_len + 64 < version_message->len) {
+                int header_len = snprintf(frame, 64, "ZVERSION %zu %zu\n", 
+                                          version_message->len, block_len);
+                memmove(frame + header_len, block, block_len);
+                frame_len = (size_t)header_len + block_len;
+            }
+        }
+    }
+
+    if (frame_len > 0) {
+        io_backend_fanout(compressed_fds, compressed_count, frame, frame_len);
+    } else {
+        // Not worth compressing: everyone gets the plain message
+        memcpy(plain_fds + plain_count, compressed_fds, 
+               compressed_count * sizeof(int));
+        plain_count += compressed_count;
+    }
+    io_backend_fanout(plain_fds, plain_count, version_message->data, 
+                      version_message->len);
+    pthread_mutex_unlock(&clients_mutex);
+    free(frame);
+}
+
+// Read one '\n'-terminated line (without the newline). Returns -1 on EOF
+static int read_line(line_reader_t *reader, char *out, size_t cap) {
+    size_t len = 0;
+    while (1) {
+        while (reader->start < reader->end) {
+            char c = reader->buf[reader->start++];
+            if (c == '\n') {
+                out[len] = '\0';
+                return (int)len;
+            }
+            if (len + 1 < cap) {
+                out[len++] = c;
+            }
+        }
+        ssize_t n = read(reader->fd, reader->buf, sizeof(reader->buf));
+        if (n <= 0) {
+            return -1;
+        }
+        reader->start = 0;
+        reader->end = (size_t)n;
+    }
+}
+
+// Read exactly len bytes, draining buffered input first
+static int read_exact(line_reader_t *reader, char *out, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        if (reader->start == reader->end) {
+            ssize_t n = read(reader->fd, reader->buf, sizeof(reader->buf));
+            if (n <= 0) {
+                return -1;
+            }
+            reader->start = 0;
+            reader->end = (size_t)n;
+        }
+        size_t chunk = reader->end - reader->start;
+        if (chunk > len - got) {
+            chunk = len - got;
+        }
+        memcpy(out + got, reader->buf + reader->start, chunk);
+        reader->start += chunk;
+        got += chunk;
+    }
+    return 0;
+}
+
+static line_reader_t leader_reader;
+
+// Join a leader as a replica: run the client handshake under the reserved 
+// follower name and load the leader's committed document
+int connect_to_leader(pid_t pid) {
+    sigset_t ack_set;
+    sigemptyset(&ack_set);
+    sigaddset(&ack_set, SIGRTMIN + 1);
+    struct timespec timeout = {LEADER_HANDSHAKE_TIMEOUT_SEC, 0};
+
+    if (kill(pid, SIGRTMIN) < 0) {
+        perror("Failed to signal leader");
+        return -1;
+    }
+    // SIGRTMIN+1 is blocked in every thread, so it can be waited on here
+    if (sigtimedwait(&ack_set, NULL, &timeout) < 0) {
+        fprintf(stderr, "Leader did not respond to connection request\n");
+        return -1;
+    }
+
+    char fifo_c2s[64];
+    char fifo_s2c[64];
+    snprintf(fifo_c2s, sizeof(fifo_c2s), "FIFO_C2S_%d", getpid());
+    snprintf(fifo_s2c, sizeof(fifo_s2c), "FIFO_S2C_%d", getpid());
+    leader_write_fd = open(fifo_c2s, O_WRONLY);
+    if (leader_write_fd < 0) {
+        perror("Failed to open leader C2S FIFO");
+        return -1;
+    }
+    leader_read_fd = open(fifo_s2c, O_RDONLY);
+    if (leader_read_fd < 0) {
+        perror("Failed to open leader S2C FIFO");
+        close(leader_write_fd);
+        return -1;
+    }
+    dprintf(leader_write_fd, "%s\n", FOLLOWER_USERNAME);
+
+    // Role, version, length, then the committed document
+    char line[MAX_LINE_LEN];
+    leader_reader.fd = leader_read_fd;
+    if (read_line(&leader_reader, line, sizeof(line)) < 0 || 
+        strcmp(line, FOLLOWER_ROLE) != 0) {
+        fprintf(stderr, "Leader rejected follower: %s\n", line);
+        return -1;
+    }
+    if (read_line(&leader_reader, line, sizeof(line)) < 0) {
+        return -1;
+    }
+    uint64_t version = strtoull(line, NULL, 10);
+    if (read_line(&leader_reader, line, sizeof(line)) < 0) {
+        return -1;
+    }
+    size_t length = strtoull(line, NULL, 10);
+
+    char *content = (char *)malloc(length + 1);
+    if (!content || read_exact(&leader_reader, content, length) < 0) {
+        free(content);
+        return -1;
+    }
+    content[length] = '\0';
+    if (length > 0) {
+        markdown_insert(doc, doc->current_version, 0, content);
+        markdown_increment_version(doc);
+    }
+    doc->current_version = version;
+    free(content);
+
+    printf("Following leader %d at version %lu\n", pid, version);
+    fflush(stdout);
+    return 0;
+}
+
+// Send an edit to the leader, which applies it and broadcasts the result
+void forward_to_leader(const char *username, const char *command, 
+                       int utf8) {
+    pthread_mutex_lock(&leader_mutex);
+    if (leader_write_fd >= 0) {
+        dprintf(leader_write_fd, "FORWARD %s %s%s\n", username, 
+                utf8 ? "UTF8 " : "", command);
+    }
+    pthread_mutex_unlock(&leader_mutex);
+}
+
+// Re-apply the accepted edits of one VERSION message, in order. Lines 
+// have the form "EDIT <user> <command> <result>". Caller holds doc_mutex
+static void replay_version_message(const char *version_message) {
+    const char *success = " SUCCESS";
+    size_t success_len = strlen(success);
+    const char *line = version_message;
+
+    while (*line) {
+        const char *eol = strchr(line, '\n');
+        size_t len = eol ? (size_t)(eol - line) : strlen(line);
+        char user[MAX_USERNAME_LEN];
+        int offset = 0;
+
+        if (strncmp(line, "EDIT ", 5) == 0 &&
+            sscanf(line, "EDIT %127s %n", user, &offset) == 1 &&
+            offset > 0 && len > (size_t)offset + success_len &&
+            strncmp(line + len - success_len, success, success_len) == 0) {
+            char command[MAX_CMD_LEN];
+            size_t cmd_len = len - (size_t)offset - success_len;
+            if (cmd_len < sizeof(command)) {
+                memcpy(command, line + offset, cmd_len);
+                command[cmd_len] = '\0';
+                char result[256];
+                apply_edit_command(command, result);
+            }
+        }
+        line += len + (eol ? 1 : 0);
+    }
+}
+
+// Pass "<user> <reason>" from a leader REJECT line to that user's 
+// connections here as "Reject <reason>"
+static void route_rejection(const char *args) {
+    char user[MAX_USERNAME_LEN];
+    int offset = 0;
+    if (sscanf(args, "%127s %n", user, &offset) != 1 || offset == 0) {
+        return;
+    }
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active && !clients[i].is_follower && 
+            strcmp(clients[i].username, user) == 0) {
+            dprintf(clients[i].write_fd, "Reject %s\n", args + offset);
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Replay the leader's committed VERSION stream into the local replica and 
+// rebroadcast each batch to this server's clients
+void *leader_reader_thread(void *arg) {
+    (void)arg;
+    char line[MAX_LINE_LEN];
+    strbuf_t version_message = {NULL, 0, 0};
+    char presence_frame[MAX_PRESENCE_LEN];
+    static presence_frames_t relay;
+    size_t presence_len = 0;
+    int in_version = 0;
+    int in_presence = 0;
+    uint64_t version = 0;
+
+    while (server_running) {
+        int len = read_line(&leader_reader, line, sizeof(line));
+        if (len < 0) {
+            printf("Leader disconnected, replica is now read-only\n");
+            pthread_mutex_lock(&leader_mutex);
+            close(leader_write_fd);
+            leader_write_fd = -1;
+            pthread_mutex_unlock(&leader_mutex);
+            break;
+        }
+
+        if (!in_version && !in_presence) {
+            if (sscanf(line, "VERSION %lu", &version) == 1) {
+                in_version = 1;
+                version_message.len = 0;
+                strbuf_printf(&version_message, "%s\n", line);
+            } else if (strncmp(line, "REJECT ", 7) == 0) {
+                route_rejection(line + 7);
+            } else if (strcmp(line, "PRESENCE") == 0) {
+                in_presence = 1;
+                presence_len = (size_t)snprintf(presence_frame, 
+                                                sizeof(presence_frame), 
+                                                "%s\n", line);
+            }
+            continue;
+        }
+
+        if (in_presence) {
+            // Relay the leader's presence frames unchanged
+            presence_len += (size_t)snprintf(presence_frame + presence_len, 
+                                             sizeof(presence_frame) - 
+                                             presence_len, "%s\n", line);
+            if (strcmp(line, "END") == 0) {
+                // The leader keeps frames within PIPE_BUF, and a client
+                // whose pipe is full misses this one
+                in_presence = 0;
+                relay.len = relay.count = 0;
+                if (presence_len <= PIPE_BUF) {
+                    memcpy(relay.data, presence_frame, presence_len);
+                    relay.len = presence_len;
+                    relay.ends[relay.count++] = presence_len;
+                }
+                presence_fanout(&relay, &relay, NULL);
+            }
+            continue;
+        }
+
+        strbuf_append(&version_message, line, (size_t)len);
+        strbuf_append(&version_message, "\n", 1);
+
+        if (strcmp(line, "END") == 0) {
+            // Leader's version is authoritative even for all-reject batches
+            in_version = 0;
+            pthread_mutex_lock(&doc_mutex);
+            replay_version_message(version_message.data);
+            transform_cursors();
+            transform_views();
+            markdown_increment_version(doc);
+            doc->current_version = version;
+            publish_version_message(&version_message);
+            pthread_mutex_unlock(&doc_mutex);
+        }
+    }
+
+    free(version_message.data);
+    return NULL;
+}
+
+// Current time in timer ticks
+static uint64_t current_tick(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * TICKS_PER_SEC + 
+           (uint64_t)now.tv_nsec / (TIMER_TICK_MS * 1000000ULL);
+}
+
+// Push a client's idle deadline out by the full timeout. O(1)
+void touch_client_deadline(int client_index) {
+    if (idle_timeout_sec <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&timer_mutex);
+    timer_wheel_schedule(&idle_wheel, &idle_timers[client_index], 
+                         current_tick() + 
+                         (uint64_t)idle_timeout_sec * TICKS_PER_SEC);
+    pthread_mutex_unlock(&timer_mutex);
+}
+
+typedef struct {
+    int indices[MAX_CLIENTS];
+    int count;
+} expired_set_t;
+
+// Wheel callback: collect the slot and give it one more timeout to finish
+// tearing down before it is nudged again
+static void collect_expired(timer_node *node, void *ctx) {
+    expired_set_t *expired = (expired_set_t *)ctx;
+    expired->indices[expired->count++] = node->id;
+    timer_wheel_schedule(&idle_wheel, node, idle_wheel.now + 
+                         (uint64_t)idle_timeout_sec * TICKS_PER_SEC);
+}
+
+// Make an idle client's own thread tear the session down. The thread may
+// be blocked opening the FIFOs or in read(), so open the other end of each
+// without blocking and inject a DISCONNECT line
+static void reap_client(int client_index) {
+    pthread_mutex_lock(&clients_mutex);
+    int active = clients[client_index].active;
+    pid_t client_pid = clients[client_index].client_pid;
+    char username[MAX_USERNAME_LEN];
+    strcpy(username, clients[client_index].username);
+    pthread_mutex_unlock(&clients_mutex);
+    if (!active) {
+        return;
+    }
+
+    printf("Client timed out: %s (pid %d)\n", 
+           username[0] ? username : "<handshake>", client_pid);
+
+    char fifo_c2s[64];
+    char fifo_s2c[64];
+    snprintf(fifo_c2s, sizeof(fifo_c2s), "FIFO_C2S_%d", client_pid);
+    snprintf(fifo_s2c, sizeof(fifo_s2c), "FIFO_S2C_%d", client_pid);
+
+    int s2c = open(fifo_s2c, O_RDONLY | O_NONBLOCK);
+    int c2s = open(fifo_c2s, O_WRONLY | O_NONBLOCK);
+    if (c2s >= 0) {
+        write(c2s, "DISCONNECT\n", 11);
+        close(c2s);
+    }
+    if (s2c >= 0) {
+        close(s2c);
+    }
+}
+
+// Background thread that advances the idle-deadline wheel every tick and
+// reclaims clients that stopped sending, including heartbeats. In follower 
+// mode it also keeps this server's own session with the leader alive
+void *reaper_thread(void *arg) {
+    (void)arg;
+    uint64_t last_heartbeat = current_tick();
+
+    while (server_running) {
+        usleep(TIMER_TICK_MS * BROADCAST_INTERVAL_MULTIPLIER);
+        uint64_t now = current_tick();
+
+        if (idle_timeout_sec > 0) {
+            expired_set_t expired;
+            expired.count = 0;
+            pthread_mutex_lock(&timer_mutex);
+            timer_wheel_advance(&idle_wheel, now, collect_expired, &expired);
+            pthread_mutex_unlock(&timer_mutex);
+
+            for (int i = 0; i < expired.count; i++) {
+                reap_client(expired.indices[i]);
+            }
+        }
+
+        if (leader_pid > 0 && 
+            now - last_heartbeat >= LEADER_HEARTBEAT_SEC * TICKS_PER_SEC) {
+            last_heartbeat = now;
+            pthread_mutex_lock(&leader_mutex);
+            if (leader_write_fd >= 0) {
+                dprintf(leader_write_fd, "HEARTBEAT\n");
+            }
+            pthread_mutex_unlock(&leader_mutex);
+        }
+    }
+    return NULL;
+}
+
+// Thread to handle server stdin commands
 void *stdin_command_thread(void *arg) {
     (void)arg;
     char command[128];
@@ -452,6 +2449,7 @@ void *stdin_command_thread(void *arg) {
             if (active_clients == 0) {
                 printf("Shutting down server...\n");
                 save_document_to_file();
+                snapshot_document();
                 server_running = 0;
                 exit(0);
             } else {
@@ -469,80 +2467,579 @@ void *stdin_command_thread(void *arg) {
         } 
         else if (strcmp(command, "LOG?") == 0) {
             pthread_mutex_lock(&log_mutex);
-            printf("LOG?\n%s", broadcast_log);
+            printf("LOG?\n%s", broadcast_log.data ? broadcast_log.data : "");
             pthread_mutex_unlock(&log_mutex);
         }
     }
-    return NULL;
+    return NULL;
+}
+
+// Authenticate client against roles.txt
+int authenticate_client(const char *username, char *role, int *permission) {
+    FILE *roles_file = fopen("roles.txt", "r");
+    if (!roles_file) {
+        return 0;
+    }
+
+    char file_username[MAX_USERNAME_LEN];
+    char file_role[MAX_ROLE_LEN];
+    while (fscanf(roles_file, "%127s %15s", file_username, file_role) == 2) {
+        if (strcmp(file_username, username) == 0) {
+            strcpy(role, file_role);
+            *permission = (strcmp(file_role, "write") == 0) ? 1 : 0;
+            fclose(roles_file);
+            return 1;
+        }
+    }
+    
+    fclose(roles_file);
+    return 0;
+}
+
+// 1 if the command edits the document, in any of its position forms
+static int is_write_command(const char *command) {
+    static const char *write_commands[] = {"INSERT", "DEL", "NEWLINE", 
+                                           "HEADING", "BOLD", "ITALIC", 
+                                           "BLOCKQUOTE", "ORDERED_LIST", 
+                                           "UNORDERED_LIST", "CODE", 
+                                           "HORIZONTAL_RULE", "LINK", 
+                                           "REPLACE_ALL", "MOVE", "COPY", 
+                                           "MULTI_INSERT", "MULTI_DEL"};
+    char cmd_type[32];
+    if (sscanf(command, "%31s", cmd_type) != 1) {
+        return 0;
+    }
+    size_t len = strlen(cmd_type);
+    if (len > 3 && strcmp(cmd_type + len - 3, "_LC") == 0) {
+        cmd_type[len - 3] = '\0';
+    }
+    size_t num_write_commands = sizeof(write_commands) / 
+                                sizeof(write_commands[0]);
+    for (size_t i = 0; i < num_write_commands; i++) {
+        if (strcmp(cmd_type, write_commands[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 1 if the user may run the command, else the rejection is in result
+static int may_execute(const char *username, const char *command, 
+                       char *result) {
+    // Check user permissions
+    int user_permission = 0;
+    int found = 0;
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active && strcmp(clients[i].username, username) == 0) {
+            user_permission = clients[i].permission;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    // Users who are not connected here (e.g. forwarded by a follower) are
+    // checked against roles.txt directly
+    if (!found) {
+        char role[MAX_ROLE_LEN];
+        authenticate_client(username, role, &user_permission);
+    }
+
+    if (is_write_command(command) && !user_permission) {
+        strcpy(result, "Reject UNAUTHORISED");
+        return 0;
+    }
+    return 1;
+}
+
+// Execute a queued edit command
+void execute_queued_command(const char *username, const char *command, 
+                           char *result) {
+    if (may_execute(username, command, result)) {
+        apply_edit_command(command, result);
+    }
+}
+
+// Where the positions sit in each edit command
+#define MAX_EDIT_POSITIONS 3
+static const struct {
+    const char *name;
+    int skip;    // Leading arguments that are not positions
+    int count;   // Position arguments that follow them
+    int has_len; // The second position is a length from the first
+} edit_forms[] = {
+    {"INSERT", 0, 1, 0}, {"DEL", 0, 2, 1}, {"NEWLINE", 0, 1, 0}, 
+    {"HEADING", 1, 1, 0}, {"BOLD", 0, 2, 0}, {"ITALIC", 0, 2, 0}, 
+    {"BLOCKQUOTE", 0, 1, 0}, {"ORDERED_LIST", 0, 1, 0}, 
+    {"UNORDERED_LIST", 0, 1, 0}, {"CODE", 0, 2, 0}, 
+    {"HORIZONTAL_RULE", 0, 1, 0}, {"LINK", 0, 2, 0}, 
+    {"MOVE", 0, 3, 1}, {"COPY", 0, 3, 1}
+};
+#define NUM_EDIT_FORMS (sizeof(edit_forms) / sizeof(edit_forms[0]))
+
+// Index of the form for a command name of len bytes, or NUM_EDIT_FORMS
+static size_t find_edit_form(const char *name, size_t len) {
+    size_t form = 0;
+    while (form < NUM_EDIT_FORMS && 
+           (strlen(edit_forms[form].name) != len || 
+            strncmp(name, edit_forms[form].name, len) != 0)) {
+        form++;
+    }
+    return form;
+}
+
+// Skip the non-position arguments of a form, starting after its name
+static char *skip_edit_args(char *p, size_t form) {
+    for (int i = 0; i < edit_forms[form].skip; i++) {
+        while (*p == ' ') {
+            p++;
+        }
+        while (*p && *p != ' ') {
+            p++;
+        }
+    }
+    return p;
 }
 
-// Authenticate client against roles.txt
-int authenticate_client(const char *username, char *role, int *permission) {
-    FILE *roles_file = fopen("roles.txt", "r");
-    if (!roles_file) {
-        return 0;
+// Replace command with name and head (the arguments before the 
+// positions), count byte positions, then tail. Returns -1 if it does not
+// fit in cap
+static int rewrite_edit_command(char *command, size_t cap, const char *name,
+                                const char *head, int head_len, 
+                                const size_t *bytes, int count, 
+                                const char *tail) {
+    char rewritten[MAX_CMD_LEN];
+    int n = snprintf(rewritten, sizeof(rewritten), "%s%.*s", name, 
+                     head_len, head);
+    for (int i = 0; i < count && n >= 0 && (size_t)n < sizeof(rewritten); 
+         i++) {
+        n += snprintf(rewritten + n, sizeof(rewritten) - (size_t)n, " %zu", 
+                      bytes[i]);
+    }
+    if (n >= 0 && (size_t)n < sizeof(rewritten)) {
+        n += snprintf(rewritten + n, sizeof(rewritten) - (size_t)n, "%s", 
+                      tail);
     }
+    if (n < 0 || (size_t)n >= sizeof(rewritten) || (size_t)n >= cap) {
+        return -1;
+    }
+    memcpy(command, rewritten, (size_t)n + 1);
+    return 0;
+}
 
-    char file_username[MAX_USERNAME_LEN];
-    char file_role[MAX_ROLE_LEN];
-    while (fscanf(roles_file, "%127s %15s", file_username, file_role) == 2) {
-        if (strcmp(file_username, username) == 0) {
-            strcpy(role, file_role);
-            *permission = (strcmp(file_role, "write") == 0) ? 1 : 0;
-            fclose(roles_file);
-            return 1;
+// Parse the offsets that end a MULTI_ command. Returns how many there 
+// are, or 0 if there are none, too many, or anything else follows
+static size_t parse_positions(const char *p, size_t *positions) {
+    size_t count = 0;
+    for (;;) {
+        while (*p == ' ') {
+            p++;
+        }
+        if (*p == '\0') {
+            return count;
         }
+        char *end = NULL;
+        unsigned long long value = strtoull(p, &end, 10);
+        if (end == p || count == MAX_MULTI_POSITIONS) {
+            return 0;
+        }
+        positions[count++] = (size_t)value;
+        p = end;
     }
-    
-    fclose(roles_file);
-    return 0;
 }
 
-// Execute a queued edit command
-void execute_queued_command(const char *username, const char *command, 
-                           char *result) {
-    // Check user permissions
-    int user_permission = 0;
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].active && strcmp(clients[i].username, username) == 0) {
-            user_permission = clients[i].permission;
-            break;
+// Code-point form of MULTI_INSERT <text> <pos...> and MULTI_DEL <len> 
+// <pos...>. A MULTI_DEL length must cover the same number of bytes at 
+// every position, since the byte form has one length for all of them
+static int translate_utf8_multi(char *command, size_t cap, 
+                                const char *cmd_type) {
+    char *args = command + strlen(cmd_type);
+    char *p = args;
+    while (*p == ' ') {
+        p++;
+    }
+    char *first = p;
+    while (*p && *p != ' ') {
+        p++;
+    }
+    size_t pos[MAX_MULTI_POSITIONS];
+    size_t count = parse_positions(p, pos);
+    if (count == 0 || p == first) {
+        return 0; // Malformed; apply_edit_command rejects it
+    }
+
+    size_t bytes[MAX_MULTI_POSITIONS];
+    for (size_t i = 0; i < count; i++) {
+        if (markdown_cp_to_byte(doc, pos[i], &bytes[i]) != SUCCESS) {
+            return -1;
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
+    if (strcmp(cmd_type, "MULTI_INSERT") == 0) {
+        return rewrite_edit_command(command, cap, cmd_type, args, 
+                                    (int)(p - args), bytes, (int)count, "");
+    }
 
-    // Parse command type
-    char cmd_type[32];
+    size_t len = (size_t)strtoull(first, NULL, 10);
+    size_t byte_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t end = 0;
+        if (len > SIZE_MAX - pos[i] || 
+            markdown_cp_to_byte(doc, pos[i] + len, &end) != SUCCESS) {
+            end = markdown_length(doc);
+        }
+        if (i > 0 && end - bytes[i] != byte_len) {
+            return -1;
+        }
+        byte_len = end - bytes[i];
+    }
+    char head[32];
+    snprintf(head, sizeof(head), " %zu", byte_len);
+    return rewrite_edit_command(command, cap, cmd_type, head, 
+                                (int)strlen(head), bytes, (int)count, "");
+}
+
+// Rewrite the position arguments of an edit command from code points to
+// byte offsets in the committed document, so the command is applied and
+// logged in bytes. Returns -1 if a position is out of range. Caller holds
+// doc_mutex
+static int translate_utf8_command(char *command, size_t cap) {
+    char cmd_type[32] = "";
     sscanf(command, "%31s", cmd_type);
-    
-    // Check if command requires write permission
-    const char *write_commands[] = {"INSERT", "DEL", "NEWLINE", "HEADING", 
-                                   "BOLD", "ITALIC", "BLOCKQUOTE", 
-                                   "ORDERED_LIST", "UNORDERED_LIST", "CODE", 
-                                   "HORIZONTAL_RULE", "LINK"};
-    int requires_write = 0;
-    size_t num_write_commands = sizeof(write_commands) / 
-                               sizeof(write_commands[0]);
-    for (size_t i = 0; i < num_write_commands; i++) {
-        if (strcmp(cmd_type, write_commands[i]) == 0) {
-            requires_write = 1;
-            break;
+    if (strcmp(cmd_type, "MULTI_INSERT") == 0 || 
+        strcmp(cmd_type, "MULTI_DEL") == 0) {
+        return translate_utf8_multi(command, cap, cmd_type);
+    }
+    size_t form = find_edit_form(cmd_type, strlen(cmd_type));
+    if (form == NUM_EDIT_FORMS) {
+        return 0; // Not an edit; apply_edit_command rejects it
+    }
+
+    // Skip the command name and any non-position arguments
+    char *args = command + strlen(cmd_type);
+    char *p = skip_edit_args(args, form);
+    int args_len = (int)(p - args);
+    const int count = edit_forms[form].count;
+    const int has_len = edit_forms[form].has_len;
+
+    size_t pos[MAX_EDIT_POSITIONS] = {0};
+    for (int i = 0; i < count; i++) {
+        char *end = NULL;
+        pos[i] = (size_t)strtoull(p, &end, 10);
+        if (end == p) {
+            return 0; // Malformed; apply_edit_command rejects it
         }
+        p = end;
     }
-    
-    if (requires_write && !user_permission) {
-        strcpy(result, "Reject UNAUTHORISED");
+
+    // A length (DEL, MOVE, COPY) is translated as its end point and 
+    // measured again in bytes
+    size_t bytes[MAX_EDIT_POSITIONS] = {0};
+    if (has_len) {
+        pos[1] += pos[0];
+        if (pos[1] < pos[0]) {
+            pos[1] = SIZE_MAX;
+        }
+        if (markdown_cp_to_byte(doc, pos[1], &bytes[1]) != SUCCESS) {
+            // Past the end: delete to the end, as in byte mode
+            bytes[1] = markdown_length(doc);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if ((i != 1 || !has_len) && 
+            markdown_cp_to_byte(doc, pos[i], &bytes[i]) != SUCCESS) {
+            return -1;
+        }
+    }
+    if (has_len) {
+        bytes[1] -= bytes[0];
+    }
+
+    return rewrite_edit_command(command, cap, cmd_type, args, args_len, 
+                                bytes, count, p);
+}
+
+// Byte offset of a line and column (both from 0) in the committed 
+// document. The column counts code points for UTF-8 clients and may not
+// pass the end of the line. Returns -1 if there is no such position
+static int line_col_to_byte(size_t line, size_t col, int utf8, 
+                            size_t *byte) {
+    size_t start = 0;
+    size_t end = 0;
+    if (markdown_offset_of_line(doc, line, &start) != SUCCESS) {
+        return -1;
+    }
+    if (markdown_offset_of_line(doc, line + 1, &end) == SUCCESS) {
+        end--; // Before the newline
+    } else {
+        end = markdown_length(doc);
+    }
+    // A line has at least as many bytes as code points
+    if (col > end - start) {
+        return -1;
+    }
+    if (!utf8) {
+        *byte = start + col;
+        return 0;
+    }
+    size_t cp = 0;
+    if (markdown_byte_to_cp(doc, start, &cp) != SUCCESS || 
+        markdown_cp_to_byte(doc, cp + col, byte) != SUCCESS) {
+        return -1;
+    }
+    return (*byte <= end) ? 0 : -1;
+}
+
+// Rewrite a line-addressed edit ("INSERT_LC 3 0 text") into its byte 
+// form ("INSERT 57 text") so it is applied, checked and logged like any
+// other edit. Each position becomes a line and a column; DEL_LC, MOVE_LC 
+// and COPY_LC take the end line and column instead of a length. Returns 1 if the command was
+// rewritten, 0 if it is not line-addressed and -1 if a position is not in
+// the committed document. Caller holds doc_mutex
+static int translate_line_command(char *command, size_t cap, int utf8) {
+    char cmd_type[32] = "";
+    sscanf(command, "%31s", cmd_type);
+    size_t name_len = strlen(cmd_type);
+    if (name_len < 4 || strcmp(cmd_type + name_len - 3, "_LC") != 0) {
+        return 0;
+    }
+    size_t form = find_edit_form(cmd_type, name_len - 3);
+    if (form == NUM_EDIT_FORMS) {
+        return 0; // Not an edit; apply_edit_command rejects it
+    }
+
+    char *args = command + name_len;
+    char *p = skip_edit_args(args, form);
+    int args_len = (int)(p - args);
+    const int count = edit_forms[form].count;
+
+    size_t bytes[MAX_EDIT_POSITIONS] = {0};
+    for (int i = 0; i < count; i++) {
+        size_t lc[2];
+        for (int j = 0; j < 2; j++) {
+            char *end = NULL;
+            lc[j] = (size_t)strtoull(p, &end, 10);
+            if (end == p) {
+                return -1;
+            }
+            p = end;
+        }
+        if (line_col_to_byte(lc[0], lc[1], utf8, &bytes[i]) < 0) {
+            return -1;
+        }
+    }
+    if (edit_forms[form].has_len) {
+        if (bytes[1] < bytes[0]) {
+            return -1;
+        }
+        bytes[1] -= bytes[0];
+    }
+
+    if (rewrite_edit_command(command, cap, edit_forms[form].name, args, 
+                             args_len, bytes, count, p) < 0) {
+        return -1;
+    }
+    return 1;
+}
+
+// Where the positions of a byte-form edit sit, for rebase_deferred. A 
+// length is held as the end point of its range
+typedef struct {
+    char name[32];
+    const char *head;    // Arguments before the positions
+    int head_len;
+    const char *tail;    // Text after them
+    int form;            // Index into edit_forms, or -1 for MULTI_*
+    int multi_del;       // pos holds a start and an end per cursor
+    size_t count;
+    size_t pos[2 * MAX_MULTI_POSITIONS];
+} edit_positions_t;
+
+// Find the positions of a byte-form edit. Returns 0 if it has none to 
+// rebase: REPLACE_ALL, or anything apply_edit_command rejects anyway
+static int find_edit_positions(char *command, edit_positions_t *e) {
+    e->name[0] = '\0';
+    sscanf(command, "%31s", e->name);
+    char *args = command + strlen(e->name);
+    e->head = args;
+    e->multi_del = (strcmp(e->name, "MULTI_DEL") == 0);
+    if (e->multi_del || strcmp(e->name, "MULTI_INSERT") == 0) {
+        char *p = args;
+        while (*p == ' ') {
+            p++;
+        }
+        char *first = p;
+        while (*p && *p != ' ') {
+            p++;
+        }
+        size_t starts[MAX_MULTI_POSITIONS];
+        size_t count = parse_positions(p, starts);
+        if (count == 0 || p == first) {
+            return 0;
+        }
+        e->head_len = (int)(p - args);
+        e->tail = "";
+        e->form = -1;
+        size_t len = (size_t)strtoull(first, NULL, 10);
+        e->count = 0;
+        for (size_t i = 0; i < count; i++) {
+            e->pos[e->count++] = starts[i];
+            if (e->multi_del) {
+                e->pos[e->count++] = (len > SIZE_MAX - starts[i]) 
+                                   ? SIZE_MAX : starts[i] + len;
+            }
+        }
+        return 1;
+    }
+
+    size_t form = find_edit_form(e->name, strlen(e->name));
+    if (form == NUM_EDIT_FORMS) {
+        return 0;
+    }
+    char *p = skip_edit_args(args, form);
+    e->head_len = (int)(p - args);
+    e->form = (int)form;
+    e->count = (size_t)edit_forms[form].count;
+    for (size_t i = 0; i < e->count; i++) {
+        char *end = NULL;
+        e->pos[i] = (size_t)strtoull(p, &end, 10);
+        if (end == p) {
+            return 0;
+        }
+        p = end;
+    }
+    if (edit_forms[form].has_len) {
+        e->pos[1] = (e->pos[1] > SIZE_MAX - e->pos[0]) 
+                  ? SIZE_MAX : e->pos[0] + e->pos[1];
+    }
+    e->tail = p;
+    return 1;
+}
+
+// Whether position i of an edit ends a range, so that text inserted 
+// right at it stays outside the range
+static int is_range_end(const edit_positions_t *e, size_t i) {
+    return e->multi_del ? (i % 2 == 1) : (e->form >= 0 && i == 1);
+}
+
+// Write rebased positions back into an edit found by find_edit_positions.
+// Returns -1 if it no longer has a byte form: a MULTI_DEL whose ranges 
+// now differ in length, or a command that no longer fits
+static int rewrite_edit_positions(char *command, size_t cap, 
+                                  const edit_positions_t *e, 
+                                  size_t *mapped) {
+    // A range that shrank to nothing keeps its start
+    for (size_t i = 1; i < e->count; i++) {
+        if (is_range_end(e, i) && e->pos[i] >= e->pos[i - 1] && 
+            mapped[i] < mapped[i - 1]) {
+            mapped[i] = mapped[i - 1];
+        }
+    }
+    if (e->form >= 0) {
+        if (edit_forms[e->form].has_len) {
+            mapped[1] -= mapped[0];
+        }
+        return rewrite_edit_command(command, cap, e->name, e->head, 
+                                    e->head_len, mapped, (int)e->count, 
+                                    e->tail);
+    }
+    if (!e->multi_del) {
+        return rewrite_edit_command(command, cap, e->name, e->head, 
+                                    e->head_len, mapped, (int)e->count, "");
+    }
+
+    size_t starts[MAX_MULTI_POSITIONS];
+    size_t len = mapped[1] - mapped[0];
+    for (size_t i = 0; i < e->count / 2; i++) {
+        if (mapped[2 * i + 1] - mapped[2 * i] != len) {
+            return -1;
+        }
+        starts[i] = mapped[2 * i];
+    }
+    char head[32];
+    snprintf(head, sizeof(head), " %zu", len);
+    return rewrite_edit_command(command, cap, e->name, head, 
+                                (int)strlen(head), starts, 
+                                (int)(e->count / 2), "");
+}
+
+// Carry edits held over for a later version through the batch about to
+// be committed. Their positions are in the committed document the batch
+// was applied to, and would land on the wrong text in the next version:
+// after "INSERT 0 abc", a held-over "DEL 0 1" must become "DEL 3 1". All
+// positions are mapped in one walk of the working list. An edit that 
+// cannot be rebased is rejected when its turn comes. Caller holds 
+// doc_mutex, before markdown_increment_version
+static void rebase_deferred(command_node_t *first) {
+    edit_positions_t e;
+    size_t total = 0;
+    for (command_node_t *n = first; n; n = n->next) {
+        if (!n->stale && translate_queued_command(n) < 0) {
+            n->stale = "Reject INVALID_POSITION";
+        }
+        if (!n->stale && find_edit_positions(n->command, &e)) {
+            total += e.count;
+        }
+    }
+    if (total == 0) {
         return;
     }
 
+    size_t *positions = (size_t *)malloc(total * sizeof(size_t));
+    char *ends = (char *)malloc(total);
+    size_t at = 0;
+    for (command_node_t *n = first; n; n = n->next) {
+        if (n->stale || !find_edit_positions(n->command, &e)) {
+            continue;
+        }
+        if (!positions || !ends) {
+            n->stale = "Reject INVALID_POSITION"; // Cannot be placed
+            continue;
+        }
+        for (size_t i = 0; i < e.count; i++) {
+            positions[at + i] = e.pos[i];
+            ends[at + i] = (char)is_range_end(&e, i);
+        }
+        at += e.count;
+    }
+    if (positions && ends) {
+        markdown_transform_positions(doc, positions, ends, total);
+        at = 0;
+        for (command_node_t *n = first; n; n = n->next) {
+            if (n->stale || !find_edit_positions(n->command, &e)) {
+                continue;
+            }
+            if (rewrite_edit_positions(n->command, sizeof(n->command), &e,
+                                       positions + at) < 0) {
+                n->stale = "Reject INVALID_POSITION";
+            }
+            at += e.count;
+        }
+    }
+    free(positions);
+    free(ends);
+}
+
+// Apply an edit command to the document without permission checks. Used 
+// for queued commands and for replaying a leader's accepted edits
+void apply_edit_command(const char *command, char *result) {
+    apply_edit_to(doc, command, result);
+}
+
+// apply_edit_command on a given document, e.g. one region shard
+static void apply_edit_to(document *target, const char *command, 
+                          char *result) {
+    uint64_t version = target->current_version;
+    char cmd_type[32] = "";
+    sscanf(command, "%31s", cmd_type);
+
     // Execute command
     int ret = 0;
     if (strcmp(cmd_type, "INSERT") == 0) {
         size_t pos = 0;
         char content[256];
         if (sscanf(command, "INSERT %zu %255[^\n]", &pos, content) == 2) {
-            ret = markdown_insert(doc, doc->current_version, pos, content);
+            ret = markdown_insert(target, version, pos, content);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -551,7 +3048,7 @@ void execute_queued_command(const char *username, const char *command,
         size_t pos = 0;
         size_t len = 0;
         if (sscanf(command, "DEL %zu %zu", &pos, &len) == 2) {
-            ret = markdown_delete(doc, doc->current_version, pos, len);
+            ret = markdown_delete(target, version, pos, len);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -559,7 +3056,7 @@ void execute_queued_command(const char *username, const char *command,
     } else if (strcmp(cmd_type, "NEWLINE") == 0) {
         size_t pos = 0;
         if (sscanf(command, "NEWLINE %zu", &pos) == 1) {
-            ret = markdown_newline(doc, doc->current_version, pos);
+            ret = markdown_newline(target, version, pos);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -568,7 +3065,7 @@ void execute_queued_command(const char *username, const char *command,
         size_t level = 0;
         size_t pos = 0;
         if (sscanf(command, "HEADING %zu %zu", &level, &pos) == 2) {
-            ret = markdown_heading(doc, doc->current_version, level, pos);
+            ret = markdown_heading(target, version, level, pos);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -577,7 +3074,7 @@ void execute_queued_command(const char *username, const char *command,
         size_t start = 0;
         size_t end = 0;
         if (sscanf(command, "BOLD %zu %zu", &start, &end) == 2) {
-            ret = markdown_bold(doc, doc->current_version, start, end);
+            ret = markdown_bold(target, version, start, end);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -586,7 +3083,7 @@ void execute_queued_command(const char *username, const char *command,
         size_t start = 0;
         size_t end = 0;
         if (sscanf(command, "ITALIC %zu %zu", &start, &end) == 2) {
-            ret = markdown_italic(doc, doc->current_version, start, end);
+            ret = markdown_italic(target, version, start, end);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -594,7 +3091,7 @@ void execute_queued_command(const char *username, const char *command,
     } else if (strcmp(cmd_type, "BLOCKQUOTE") == 0) {
         size_t pos = 0;
         if (sscanf(command, "BLOCKQUOTE %zu", &pos) == 1) {
-            ret = markdown_blockquote(doc, doc->current_version, pos);
+            ret = markdown_blockquote(target, version, pos);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -602,7 +3099,7 @@ void execute_queued_command(const char *username, const char *command,
     } else if (strcmp(cmd_type, "ORDERED_LIST") == 0) {
         size_t pos = 0;
         if (sscanf(command, "ORDERED_LIST %zu", &pos) == 1) {
-            ret = markdown_ordered_list(doc, doc->current_version, pos);
+            ret = markdown_ordered_list(target, version, pos);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -610,7 +3107,7 @@ void execute_queued_command(const char *username, const char *command,
     } else if (strcmp(cmd_type, "UNORDERED_LIST") == 0) {
         size_t pos = 0;
         if (sscanf(command, "UNORDERED_LIST %zu", &pos) == 1) {
-            ret = markdown_unordered_list(doc, doc->current_version, pos);
+            ret = markdown_unordered_list(target, version, pos);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -619,7 +3116,7 @@ void execute_queued_command(const char *username, const char *command,
         size_t start = 0;
         size_t end = 0;
         if (sscanf(command, "CODE %zu %zu", &start, &end) == 2) {
-            ret = markdown_code(doc, doc->current_version, start, end);
+            ret = markdown_code(target, version, start, end);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -627,7 +3124,7 @@ void execute_queued_command(const char *username, const char *command,
     } else if (strcmp(cmd_type, "HORIZONTAL_RULE") == 0) {
         size_t pos = 0;
         if (sscanf(command, "HORIZONTAL_RULE %zu", &pos) == 1) {
-            ret = markdown_horizontal_rule(doc, doc->current_version, pos);
+            ret = markdown_horizontal_rule(target, version, pos);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -637,7 +3134,63 @@ void execute_queued_command(const char *username, const char *command,
         size_t end = 0;
         char url[256];
         if (sscanf(command, "LINK %zu %zu %255s", &start, &end, url) == 3) {
-            ret = markdown_link(doc, doc->current_version, start, end, url);
+            ret = markdown_link(target, version, start, end, url);
+        } else {
+            strcpy(result, "Reject INVALID_POSITION");
+            return;
+        }
+    } else if (strcmp(cmd_type, "MOVE") == 0 || 
+               strcmp(cmd_type, "COPY") == 0) {
+        size_t start = 0;
+        size_t len = 0;
+        size_t dest = 0;
+        if (sscanf(command, "%*s %zu %zu %zu", &start, &len, &dest) == 3) {
+            ret = (cmd_type[0] == 'M') 
+                ? markdown_move(target, version, start, len, dest)
+                : markdown_copy(target, version, start, len, dest);
+        } else {
+            strcpy(result, "Reject INVALID_POSITION");
+            return;
+        }
+    } else if (strcmp(cmd_type, "MULTI_INSERT") == 0) {
+        // One word of text, then the positions
+        char content[256];
+        int offset = 0;
+        size_t positions[MAX_MULTI_POSITIONS];
+        size_t count = 0;
+        if (sscanf(command, "MULTI_INSERT %255s%n", content, &offset) == 1 &&
+            (count = parse_positions(command + offset, positions)) > 0) {
+            ret = markdown_multi_insert(target, version, content, 
+                                        positions, count);
+        } else {
+            strcpy(result, "Reject INVALID_POSITION");
+            return;
+        }
+    } else if (strcmp(cmd_type, "MULTI_DEL") == 0) {
+        size_t len = 0;
+        int offset = 0;
+        size_t positions[MAX_MULTI_POSITIONS];
+        size_t count = 0;
+        if (sscanf(command, "MULTI_DEL %zu%n", &len, &offset) == 1 && 
+            (count = parse_positions(command + offset, positions)) > 0) {
+            ret = markdown_multi_delete(target, version, len, 
+                                        positions, count);
+        } else {
+            strcpy(result, "Reject INVALID_POSITION");
+            return;
+        }
+    } else if (strcmp(cmd_type, "REPLACE_ALL") == 0) {
+        // The needle is one word; the replacement is the rest of the line
+        // and may be empty
+        char needle[256];
+        int offset = 0;
+        if (sscanf(command, "REPLACE_ALL %255s%n", needle, &offset) == 1) {
+            const char *replacement = command + offset;
+            if (*replacement == ' ') {
+                replacement++;
+            }
+            ret = markdown_replace_all(target, version, needle, 
+                                       replacement, NULL);
         } else {
             strcpy(result, "Reject INVALID_POSITION");
             return;
@@ -669,22 +3222,371 @@ void execute_queued_command(const char *username, const char *command,
 
 // Clean up client connection
 void cleanup_client_connection(int client_index) {
+    pthread_mutex_lock(&timer_mutex);
+    timer_wheel_cancel(&idle_timers[client_index]);
+    pthread_mutex_unlock(&timer_mutex);
+
     pthread_mutex_lock(&clients_mutex);
     clients[client_index].active = 0;
+    drop_transaction(&clients[client_index]); // Never reached TXN_END
+    if (clients[client_index].presence_fd > 0) {
+        close(clients[client_index].presence_fd);
+    }
     memset(&clients[client_index], 0, sizeof(client_t));
     pthread_mutex_unlock(&clients_mutex);
 }
 
+// Store the committed text under the current version. Caller holds 
+// doc_mutex
+void snapshot_document(void) {
+    if (!store_is_open()) {
+        return;
+    }
+    size_t len = 0;
+    char *content = markdown_flatten_checksum(doc, &len, NULL);
+    if (content) {
+        store_snapshot(doc->current_version, content, len);
+        free(content);
+    }
+}
+
 // Save document to file
 void save_document_to_file(void) {
-    FILE *file = fopen("doc.md", "w");
-    if (file) {
-        char *content = markdown_flatten(doc);
+    int fd = open("doc.md", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        size_t len = 0;
+        char *content = markdown_flatten_checksum(doc, &len, NULL);
         if (content) {
-            fprintf(file, "%s", content);
+            io_backend_write_all(fd, content, len);
             free(content);
         }
-        fclose(file);
+        close(fd);
         printf("Document saved to doc.md\n");
     }
 }
+
+// Hand a finished JSON document to the HTTP layer
+static void http_reply(http_response *resp, int status, json_writer *w) {
+    resp->status = status;
+    resp->content_type = "application/json";
+    resp->body = json_release(w, &resp->body_len);
+}
+
+static void http_error(http_response *resp, int status, const char *message) {
+    json_writer w;
+    json_init(&w);
+    json_object_begin(&w);
+    json_key(&w, "error");
+    json_string(&w, message);
+    json_object_end(&w);
+    http_reply(resp, status, &w);
+}
+
+// GET /doc: committed content and version
+static void http_get_doc(http_response *resp) {
+    json_writer w;
+    json_init(&w);
+    pthread_mutex_lock(&doc_mutex);
+    uint64_t version = doc->current_version;
+    size_t length = 0;
+    uint32_t adler = 1;
+    char *content = markdown_flatten_checksum(doc, &length, &adler);
+    pthread_mutex_unlock(&doc_mutex);
+
+    json_object_begin(&w);
+    json_key(&w, "version");
+    json_uint(&w, version);
+    json_key(&w, "length");
+    json_uint(&w, length);
+    json_key(&w, "adler32");
+    json_uint(&w, adler);
+    json_key(&w, "content");
+    json_string_len(&w, content ? content : "", length);
+    json_object_end(&w);
+    free(content);
+    http_reply(resp, 200, &w);
+}
+
+// Write one "EDIT <user> <command> <result>" log line as an object. The
+// result is "SUCCESS" or "Reject <REASON>", always the last field
+static void http_write_edit(json_writer *w, const char *line, size_t len) {
+    edit_line_t edit;
+    if (!parse_edit_line(line, len, &edit)) {
+        return;
+    }
+
+    json_object_begin(w);
+    json_key(w, "user");
+    json_string_len(w, edit.user, edit.user_len);
+    json_key(w, "command");
+    json_string_len(w, edit.command, edit.command_len);
+    json_key(w, "result");
+    json_string_len(w, edit.result, edit.result_len);
+    json_object_end(w);
+}
+
+// GET /log?from=N&to=M: committed batches in a version range
+static void http_get_log(const http_request *req, http_response *resp) {
+    char param[32];
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    if (http_query_param(req->query, "from", param, sizeof(param)) == 0) {
+        from = strtoull(param, NULL, 10);
+    }
+    if (http_query_param(req->query, "to", param, sizeof(param)) == 0) {
+        to = strtoull(param, NULL, 10);
+    }
+
+    json_writer w;
+    json_init(&w);
+    json_object_begin(&w);
+    json_key(&w, "versions");
+    json_array_begin(&w);
+
+    pthread_mutex_lock(&log_mutex);
+    const char *p = broadcast_log.data ? broadcast_log.data : "";
+    const char *log_end = p + broadcast_log.len;
+    int in_range = 0;
+    while (p < log_end) {
+        const char *eol = memchr(p, '\n', (size_t)(log_end - p));
+        size_t len = eol ? (size_t)(eol - p) : (size_t)(log_end - p);
+        if (len > 8 && strncmp(p, "VERSION ", 8) == 0) {
+            uint64_t version = strtoull(p + 8, NULL, 10);
+            in_range = (version >= from && version <= to);
+            if (in_range) {
+                json_object_begin(&w);
+                json_key(&w, "version");
+                json_uint(&w, version);
+                json_key(&w, "edits");
+                json_array_begin(&w);
+            }
+        } else if (in_range && len > 5 && strncmp(p, "EDIT ", 5) == 0) {
+            http_write_edit(&w, p, len);
+        } else if (in_range && len == 3 && strncmp(p, "END", 3) == 0) {
+            json_array_end(&w);
+            json_object_end(&w);
+            in_range = 0;
+        }
+        p += len + 1;
+    }
+    pthread_mutex_unlock(&log_mutex);
+
+    json_array_end(&w);
+    json_object_end(&w);
+    http_reply(resp, 200, &w);
+}
+
+// GET /stats: version, connections, queue depth and document memory
+static void http_get_stats(http_response *resp) {
+    md_stats stats;
+    pthread_mutex_lock(&doc_mutex);
+    uint64_t version = doc->current_version;
+    markdown_stats(doc, &stats);
+    pthread_mutex_unlock(&doc_mutex);
+
+    size_t clients_count = 0;
+    size_t followers = 0;
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active) {
+            clients_count++;
+            followers += (size_t)clients[i].is_follower;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    pthread_mutex_lock(&command_queue_mutex);
+    size_t queued = queued_total;
+    uint64_t accepted = edits_accepted;
+    uint64_t rejected_busy = edits_rejected_busy;
+    uint64_t rejected_unauthorised = edits_rejected_unauthorised;
+    uint64_t deferred = edits_deferred;
+    pthread_mutex_unlock(&command_queue_mutex);
+    pthread_mutex_lock(&doc_mutex);
+    uint64_t runs = sharded_runs;
+    uint64_t runs_edits = sharded_edits;
+    pthread_mutex_unlock(&doc_mutex);
+
+    json_writer w;
+    json_init(&w);
+    json_object_begin(&w);
+    json_key(&w, "version");
+    json_uint(&w, version);
+    json_key(&w, "clients");
+    json_uint(&w, clients_count);
+    json_key(&w, "followers");
+    json_uint(&w, followers);
+    json_key(&w, "queued");
+    json_uint(&w, queued);
+    json_key(&w, "queue");
+    json_object_begin(&w);
+    json_key(&w, "max");
+    json_uint(&w, queue_max);
+    json_key(&w, "client_max");
+    json_uint(&w, client_queue_max);
+    json_key(&w, "accepted");
+    json_uint(&w, accepted);
+    json_key(&w, "rejected_busy");
+    json_uint(&w, rejected_busy);
+    json_key(&w, "rejected_unauthorised");
+    json_uint(&w, rejected_unauthorised);
+    json_key(&w, "batch_max");
+    json_uint(&w, batch_max);
+    json_key(&w, "batch_budget_ms");
+    json_uint(&w, (uint64_t)batch_budget_ms);
+    json_key(&w, "fair");
+    json_bool(&w, fair_queuing);
+    json_key(&w, "deferred");
+    json_uint(&w, deferred);
+    json_key(&w, "shards");
+    json_uint(&w, (uint64_t)shard_count);
+    json_key(&w, "sharded_runs");
+    json_uint(&w, runs);
+    json_key(&w, "sharded_edits");
+    json_uint(&w, runs_edits);
+    json_object_end(&w);
+    json_key(&w, "following");
+    json_bool(&w, leader_pid > 0);
+    json_key(&w, "memory");
+    json_object_begin(&w);
+    json_key(&w, "segments_committed");
+    json_uint(&w, stats.segments[COMMITTED_ORIGINAL]);
+    json_key(&w, "segments_pending_ins");
+    json_uint(&w, stats.segments[PENDING_INS]);
+    json_key(&w, "segments_pending_del");
+    json_uint(&w, stats.segments[PENDING_DEL]);
+    json_key(&w, "content_bytes");
+    json_uint(&w, stats.content_bytes);
+    json_key(&w, "content_alloc_bytes");
+    json_uint(&w, stats.content_alloc_bytes);
+    json_key(&w, "buffer_bytes");
+    json_uint(&w, stats.buffer_bytes);
+    json_key(&w, "overhead_bytes");
+    json_uint(&w, stats.overhead_bytes);
+    json_key(&w, "fragmentation");
+    json_double(&w, stats.fragmentation);
+    json_object_end(&w);
+    json_object_end(&w);
+    http_reply(resp, 200, &w);
+}
+
+static void http_write_audit(uint64_t version, const char *username, 
+                             const char *command, const char *result, 
+                             void *ctx) {
+    json_writer *w = (json_writer *)ctx;
+    json_object_begin(w);
+    json_key(w, "version");
+    json_uint(w, version);
+    json_key(w, "user");
+    json_string(w, username);
+    json_key(w, "command");
+    json_string(w, command);
+    json_key(w, "result");
+    json_string(w, result);
+    json_object_end(w);
+}
+
+// GET /audit?user=U&from=N&to=M: edits of this run from the history 
+// store, served from disk through its indexes
+static void http_get_audit(const http_request *req, http_response *resp) {
+    char user[MAX_USERNAME_LEN];
+    char param[32];
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    int by_user = (http_query_param(req->query, "user", user, 
+                                    sizeof(user)) == 0);
+    if (http_query_param(req->query, "from", param, sizeof(param)) == 0) {
+        from = strtoull(param, NULL, 10);
+    }
+    if (http_query_param(req->query, "to", param, sizeof(param)) == 0) {
+        to = strtoull(param, NULL, 10);
+    }
+    if (!store_is_open()) {
+        http_error(resp, 503, "history store disabled");
+        return;
+    }
+
+    json_writer w;
+    json_init(&w);
+    json_object_begin(&w);
+    json_key(&w, "edits");
+    json_array_begin(&w);
+    store_query_edits(by_user ? user : NULL, from, to, http_write_audit, &w);
+    json_array_end(&w);
+    json_object_end(&w);
+    http_reply(resp, 200, &w);
+}
+
+// POST /edit {"username": ..., "command": ...}: queue an edit the same 
+// way a connected client would. Positions are bytes
+static void http_post_edit(const http_request *req, http_response *resp) {
+    char username[MAX_USERNAME_LEN];
+    char command[MAX_CMD_LEN];
+    if (json_get_string(req->body, req->body_len, "username", username, 
+                        sizeof(username)) < 0 || 
+        json_get_string(req->body, req->body_len, "command", command, 
+                        sizeof(command)) < 0) {
+        http_error(resp, 400, "expected {\"username\", \"command\"}");
+        return;
+    }
+    // The log is line based, so a command must stay on one line
+    if (command[0] == '\0' || strpbrk(command, "\r\n")) {
+        http_error(resp, 400, "invalid command");
+        return;
+    }
+
+    char role[MAX_ROLE_LEN];
+    int permission = 0;
+    if (!authenticate_client(username, role, &permission)) {
+        http_error(resp, 401, "unknown user");
+        return;
+    }
+    if (!permission) {
+        count_unauthorised();
+        http_error(resp, 403, "read-only user");
+        return;
+    }
+
+    if (leader_pid > 0) {
+        forward_to_leader(username, command, 0);
+    } else if (enqueue_edit_command(-1, username, command, 0) < 0) {
+        http_error(resp, 503, "queue full");
+        return;
+    }
+
+    pthread_mutex_lock(&doc_mutex);
+    uint64_t version = doc->current_version;
+    pthread_mutex_unlock(&doc_mutex);
+
+    json_writer w;
+    json_init(&w);
+    json_object_begin(&w);
+    json_key(&w, "queued");
+    json_bool(&w, 1);
+    json_key(&w, "version");
+    json_uint(&w, version);
+    json_object_end(&w);
+    http_reply(resp, 202, &w);
+}
+
+// Route a request from the HTTP gateway
+void http_gateway(const http_request *req, http_response *resp, void *ctx) {
+    (void)ctx;
+    int is_get = (strcmp(req->method, "GET") == 0);
+    int is_post = (strcmp(req->method, "POST") == 0);
+
+    if (strcmp(req->path, "/doc") == 0) {
+        is_get ? http_get_doc(resp) : http_error(resp, 405, "use GET");
+    } else if (strcmp(req->path, "/log") == 0) {
+        is_get ? http_get_log(req, resp) : http_error(resp, 405, "use GET");
+    } else if (strcmp(req->path, "/audit") == 0) {
+        is_get ? http_get_audit(req, resp) : http_error(resp, 405, "use GET");
+    } else if (strcmp(req->path, "/stats") == 0) {
+        is_get ? http_get_stats(resp) : http_error(resp, 405, "use GET");
+    } else if (strcmp(req->path, "/edit") == 0) {
+        is_post ? http_post_edit(req, resp) 
+                : http_error(resp, 405, "use POST");
+    } else {
+        http_error(resp, 404, "not found");
+    }
+}
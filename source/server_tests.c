@@ -203,6 +203,586 @@ int test_fifo_creation_logic(void) {
     return 0;
 }
 
+// Test 6: Cursor positions follow committed edits
+int test_transform_position(void) {
+    printf("\n=== Test 6: Cursor Position Transform ===\n");
+    
+    document *test_doc = markdown_init();
+    markdown_insert(test_doc, test_doc->current_version, 0, "hello world");
+    markdown_increment_version(test_doc);
+    
+    // Insert before the cursor and delete a range containing another
+    markdown_insert(test_doc, test_doc->current_version, 0, "XX");
+    markdown_delete(test_doc, test_doc->current_version, 5, 3);
+    
+    TEST_ASSERT(markdown_transform_position(test_doc, 0) == 2, 
+                "Insert at cursor pushes it right");
+    TEST_ASSERT(markdown_transform_position(test_doc, 4) == 6, 
+                "Cursor before deletion shifts by insert only");
+    TEST_ASSERT(markdown_transform_position(test_doc, 6) == 7, 
+                "Cursor inside deletion collapses to its start");
+    TEST_ASSERT(markdown_transform_position(test_doc, 9) == 8, 
+                "Cursor after deletion shifts back");
+    TEST_ASSERT(markdown_transform_position(test_doc, 11) == 10, 
+                "Cursor at end stays at end");
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 7: Code-point positions and character boundaries
+int test_codepoint_positions(void) {
+    printf("\n=== Test 7: Code-Point Positions ===\n");
+    
+    document *test_doc = markdown_init();
+    // "h\u00e9llo \u4e16\u754c!": 14 bytes, 9 code points
+    markdown_insert(test_doc, test_doc->current_version, 0, 
+                    "h\xc3\xa9llo \xe4\xb8\x96\xe7\x95\x8c!");
+    markdown_increment_version(test_doc);
+    
+    size_t byte = 0;
+    size_t cp = 0;
+    TEST_ASSERT(markdown_cp_to_byte(test_doc, 2, &byte) == SUCCESS && 
+                byte == 3, "Code point after 2-byte character maps past it");
+    TEST_ASSERT(markdown_cp_to_byte(test_doc, 8, &byte) == SUCCESS && 
+                byte == 13, "Code point after 3-byte characters maps past them");
+    TEST_ASSERT(markdown_cp_to_byte(test_doc, 9, &byte) == SUCCESS && 
+                byte == 14, "End of document maps to byte length");
+    TEST_ASSERT(markdown_cp_to_byte(test_doc, 10, &byte) == INVALID_CURSOR_POS, 
+                "Code point past the end is rejected");
+    TEST_ASSERT(markdown_byte_to_cp(test_doc, 10, &cp) == SUCCESS && cp == 7, 
+                "Byte offset maps back to code point");
+    TEST_ASSERT(markdown_byte_to_cp(test_doc, 2, &cp) == INVALID_CURSOR_POS, 
+                "Byte inside a character has no code point");
+    
+    // Edits may not split a character
+    TEST_ASSERT(markdown_insert(test_doc, test_doc->current_version, 2, "x") 
+                == INVALID_CURSOR_POS, "Insert inside a character is rejected");
+    TEST_ASSERT(markdown_delete(test_doc, test_doc->current_version, 0, 2) 
+                == INVALID_CURSOR_POS, "Delete ending inside a character is rejected");
+    TEST_ASSERT(markdown_bold(test_doc, test_doc->current_version, 7, 11) 
+                == INVALID_CURSOR_POS, "Range ending inside a character is rejected");
+    TEST_ASSERT(markdown_delete(test_doc, test_doc->current_version, 1, 2) 
+                == SUCCESS, "Delete of a whole character succeeds");
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 8: Memory counters track edits and commits
+int test_memory_stats(void) {
+    printf("\n=== Test 8: Memory Stats ===\n");
+    
+    document *test_doc = markdown_init();
+    markdown_insert(test_doc, test_doc->current_version, 0, "abcdef");
+    markdown_increment_version(test_doc);
+    
+    md_stats stats;
+    markdown_stats(test_doc, &stats);
+    TEST_ASSERT(stats.segments[COMMITTED_ORIGINAL] == 1 && 
+                stats.content_bytes == 6, "Committed segment is counted");
+    TEST_ASSERT(stats.working_segments == 0, "No working list after commit");
+    
+    // Deleting a prefix splits the segment; later positions still refer 
+    // to the committed text
+    markdown_delete(test_doc, test_doc->current_version, 0, 2);
+    markdown_insert(test_doc, test_doc->current_version, 4, "X");
+    markdown_stats(test_doc, &stats);
+    TEST_ASSERT(stats.segments[PENDING_DEL] == 1 && 
+                stats.segments[PENDING_INS] == 1, 
+                "Pending segments are counted by state");
+    TEST_ASSERT(stats.working_bytes == 7, "Working bytes match working list");
+    
+    markdown_increment_version(test_doc);
+    char *flat = markdown_flatten(test_doc);
+    TEST_ASSERT(strcmp(flat, "cdXef") == 0, 
+                "Insert after a prefix delete lands in committed coordinates");
+    free(flat);
+    markdown_stats(test_doc, &stats);
+    TEST_ASSERT(stats.segments[PENDING_DEL] == 0 && 
+                stats.content_bytes == 5, "Deleted text is released on commit");
+    TEST_ASSERT(stats.overhead_bytes > 0 && stats.fragmentation >= 0.0, 
+                "Overhead and fragmentation are reported");
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 9: Nearby edits in one version, as the edit finger resumes them
+int test_localized_edits(void) {
+    printf("\n=== Test 9: Localized Edits ===\n");
+    
+    document *test_doc = markdown_init();
+    markdown_insert(test_doc, test_doc->current_version, 0, "abcdef");
+    markdown_increment_version(test_doc);
+    
+    // Typing forward: each position is after the previous one
+    uint64_t v = test_doc->current_version;
+    markdown_insert(test_doc, v, 1, "1");
+    markdown_insert(test_doc, v, 2, "2");
+    markdown_insert(test_doc, v, 3, "3");
+    markdown_delete(test_doc, v, 4, 1);
+    markdown_insert(test_doc, v, 5, "5");
+    markdown_increment_version(test_doc);
+    char *flat = markdown_flatten(test_doc);
+    TEST_ASSERT(strcmp(flat, "a1b2c3d5f") == 0, 
+                "Forward typing lands in committed coordinates");
+    free(flat);
+    
+    // An insert inside earlier inserted text's span goes after it
+    v = test_doc->current_version;
+    markdown_insert(test_doc, v, 2, "XYZW");
+    markdown_insert(test_doc, v, 4, "Q");
+    markdown_insert(test_doc, v, 2, "N");
+    markdown_increment_version(test_doc);
+    flat = markdown_flatten(test_doc);
+    TEST_ASSERT(strcmp(flat, "a1NXYZWb2Qc3d5f") == 0, 
+                "Later position is not pulled into an earlier insert");
+    free(flat);
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 10: Line starts from the position index
+int test_line_offsets(void) {
+    printf("\n=== Test 10: Line Offsets ===\n");
+    
+    document *test_doc = markdown_init();
+    // Lines span the segments several commits leave behind
+    markdown_insert(test_doc, test_doc->current_version, 0, "one\ntwo");
+    markdown_increment_version(test_doc);
+    markdown_insert(test_doc, test_doc->current_version, 7, "\n\nfour\n");
+    markdown_increment_version(test_doc);
+    
+    size_t byte = 0;
+    TEST_ASSERT(markdown_offset_of_line(test_doc, 0, &byte) == SUCCESS && 
+                byte == 0, "First line starts at 0");
+    TEST_ASSERT(markdown_offset_of_line(test_doc, 1, &byte) == SUCCESS && 
+                byte == 4, "Line after a newline starts past it");
+    TEST_ASSERT(markdown_offset_of_line(test_doc, 3, &byte) == SUCCESS && 
+                byte == 9, "Empty line and newline in a later segment count");
+    TEST_ASSERT(markdown_offset_of_line(test_doc, 4, &byte) == SUCCESS && 
+                byte == 14, "Line after a trailing newline is the end");
+    TEST_ASSERT(markdown_offset_of_line(test_doc, 5, &byte) == 
+                INVALID_CURSOR_POS, "Line past the end is rejected");
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 11: Bulk replace, including matches that span segments
+int test_replace_all(void) {
+    printf("\n=== Test 11: Replace All ===\n");
+    
+    document *test_doc = markdown_init();
+    markdown_insert(test_doc, test_doc->current_version, 0, "cat dog ca");
+    markdown_increment_version(test_doc);
+    markdown_insert(test_doc, test_doc->current_version, 10, "t cat");
+    markdown_increment_version(test_doc);
+    
+    size_t count = 0;
+    TEST_ASSERT(markdown_replace_all(test_doc, test_doc->current_version, 
+                                     "cat", "lion", &count) == SUCCESS && 
+                count == 3, "Matches across a segment boundary are found");
+    markdown_increment_version(test_doc);
+    char *flat = markdown_flatten(test_doc);
+    TEST_ASSERT(strcmp(flat, "lion dog lion lion") == 0, 
+                "Every match is replaced");
+    free(flat);
+    
+    TEST_ASSERT(markdown_replace_all(test_doc, test_doc->current_version, 
+                                     "", "x", NULL) == INVALID_CURSOR_POS, 
+                "Empty needle is rejected");
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 12: Moving and copying ranges shares their text
+int test_move_copy(void) {
+    printf("\n=== Test 12: Move and Copy ===\n");
+    
+    // Long pieces, so no part of the moved range is short enough to be 
+    // copied inline
+    char text[101];
+    for (int i = 0; i < 100; i++) {
+        text[i] = (char)('a' + i % 26);
+    }
+    text[100] = '\0';
+    document *test_doc = markdown_init();
+    markdown_insert(test_doc, test_doc->current_version, 0, "XYZ");
+    markdown_increment_version(test_doc);
+    markdown_insert(test_doc, test_doc->current_version, 3, text);
+    markdown_increment_version(test_doc);
+    
+    md_stats before;
+    md_stats after;
+    markdown_stats(test_doc, &before);
+    TEST_ASSERT(markdown_move(test_doc, test_doc->current_version, 3, 40, 
+                              103) == SUCCESS, "Move to the end succeeds");
+    TEST_ASSERT(markdown_move(test_doc, test_doc->current_version, 0, 10, 
+                              5) == INVALID_CURSOR_POS, 
+                "Move into its own range is rejected");
+    markdown_increment_version(test_doc);
+    markdown_stats(test_doc, &after);
+    char *flat = markdown_flatten(test_doc);
+    TEST_ASSERT(strncmp(flat, "XYZ", 3) == 0 && 
+                strncmp(flat + 3, text + 40, 60) == 0 && 
+                strcmp(flat + 63, "abcdefghijklmnopqrstuvwxyzabcdefghijklmn") 
+                == 0, "Moved text lands at dest");
+    free(flat);
+    TEST_ASSERT(after.buffer_bytes == before.buffer_bytes, 
+                "Moved text is not copied into the buffers");
+    
+    TEST_ASSERT(markdown_copy(test_doc, test_doc->current_version, 1, 2, 
+                              0) == SUCCESS, "Copy to the start succeeds");
+    TEST_ASSERT(markdown_copy(test_doc, test_doc->current_version, 100, 4, 
+                              0) == INVALID_CURSOR_POS, 
+                "Copy past the end is rejected");
+    markdown_increment_version(test_doc);
+    flat = markdown_flatten(test_doc);
+    TEST_ASSERT(strncmp(flat, "YZXYZ", 5) == 0 && strlen(flat) == 105, 
+                "Copy keeps the source");
+    free(flat);
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 13: One edit at many cursors, in any order
+int test_multi_cursor(void) {
+    printf("\n=== Test 13: Multi-Cursor Edits ===\n");
+    
+    document *test_doc = markdown_init();
+    markdown_insert(test_doc, test_doc->current_version, 0, "one two three");
+    markdown_increment_version(test_doc);
+    
+    size_t inserts[] = {8, 0, 4, 4};
+    size_t deletes[] = {9, 1, 5};
+    size_t invalid[] = {0, 14};
+    TEST_ASSERT(markdown_multi_insert(test_doc, test_doc->current_version, 
+                                      "- ", inserts, 4) == SUCCESS, 
+                "Insert at several cursors succeeds");
+    TEST_ASSERT(markdown_multi_delete(test_doc, test_doc->current_version, 1,
+                                      deletes, 3) == SUCCESS, 
+                "Delete at several cursors succeeds");
+    TEST_ASSERT(markdown_multi_insert(test_doc, test_doc->current_version, 
+                                      "x", invalid, 2) == INVALID_CURSOR_POS,
+                "One invalid cursor rejects the whole command");
+    markdown_increment_version(test_doc);
+    char *flat = markdown_flatten(test_doc);
+    TEST_ASSERT(strcmp(flat, "- oe - to - tree") == 0, 
+                "Each cursor is edited once, in committed coordinates");
+    free(flat);
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 14: Discarding pending edits restores the committed document
+int test_discard_pending(void) {
+    printf("\n=== Test 14: Discard Pending Edits ===\n");
+    
+    document *test_doc = markdown_init();
+    markdown_insert(test_doc, test_doc->current_version, 0, "hello world");
+    markdown_increment_version(test_doc);
+    uint64_t version = test_doc->current_version;
+    
+    markdown_insert(test_doc, version, 0, 
+                    "a prefix long enough to live in the add buffer ");
+    markdown_delete(test_doc, version, 5, 6);
+    markdown_discard_pending(test_doc);
+    md_stats stats;
+    markdown_stats(test_doc, &stats);
+    TEST_ASSERT(stats.working_segments == 0 && stats.working_bytes == 0, 
+                "No working segments are left");
+    markdown_increment_version(test_doc);
+    TEST_ASSERT(test_doc->current_version == version, 
+                "Nothing is left to commit");
+    
+    TEST_ASSERT(markdown_insert(test_doc, version, 11, "!") == SUCCESS, 
+                "Editing continues from the committed text");
+    markdown_increment_version(test_doc);
+    char *flat = markdown_flatten(test_doc);
+    TEST_ASSERT(strcmp(flat, "hello world!") == 0, 
+                "Discarded edits never reach the next version");
+    free(flat);
+    
+    markdown_free(test_doc);
+    return 0;
+}
+
+// Test 15: Edits applied to region shards match applying them in order
+int test_region_shards(void) {
+    printf("\n=== Test 15: Region Shards ===\n");
+    
+    document *serial = markdown_init();
+    document *sharded = markdown_init();
+    const char *text = "alpha beta gamma delta epsilon zeta eta theta";
+    markdown_insert(serial, 0, 0, text);
+    markdown_insert(sharded, 0, 0, text);
+    markdown_increment_version(serial);
+    markdown_increment_version(sharded);
+    uint64_t v = serial->current_version;
+    
+    // An edit before the shards exist, at a future cut
+    markdown_insert(serial, v, 17, "<");
+    markdown_insert(sharded, v, 17, "<");
+    
+    markdown_insert(serial, v, 0, "# ");
+    markdown_delete(serial, v, 11, 6);
+    markdown_bold(serial, v, 17, 22);
+    markdown_insert(serial, v, 17, ">");
+    markdown_insert(serial, v, 45, " iota");
+    
+    size_t cuts[] = {0, 11, 17, 11, 100};
+    size_t count = 0;
+    md_shard *shards = markdown_shards_split(sharded, cuts, 5, &count);
+    TEST_ASSERT(count == 3 && shards[1].start == 11 && shards[2].start == 17,
+                "Cuts outside the document or out of order are skipped");
+    markdown_insert(&shards[0].doc, v, 0, "# ");
+    markdown_delete(&shards[1].doc, v, 11, 6);
+    markdown_bold(&shards[2].doc, v, 17, 22);
+    markdown_insert(&shards[2].doc, v, 17, ">");
+    markdown_insert(&shards[2].doc, v, 45, " iota");
+    markdown_shards_join(sharded, shards, count);
+    
+    md_stats a;
+    md_stats b;
+    markdown_increment_version(serial);
+    markdown_increment_version(sharded);
+    markdown_stats(serial, &a);
+    markdown_stats(sharded, &b);
+    char *expected = markdown_flatten(serial);
+    char *flat = markdown_flatten(sharded);
+    TEST_ASSERT(strcmp(flat, expected) == 0, 
+                "Sharded edits give the same document as serial edits");
+    TEST_ASSERT(b.content_bytes == a.content_bytes && 
+                b.working_segments == 0 && 
+                b.segments[COMMITTED_ORIGINAL] == b.committed_segments, 
+                "Shard counters fold back into the document");
+    free(expected);
+    free(flat);
+    
+    markdown_free(serial);
+    markdown_free(sharded);
+    return 0;
+}
+
+// Test 16: Range reads copy only the requested bytes and lines
+int test_range_reads(void) {
+    printf("\n=== Test 16: Range Reads ===\n");
+    
+    document *doc = markdown_init();
+    markdown_insert(doc, 0, 0, "one\nthree\n");
+    markdown_increment_version(doc);
+    markdown_insert(doc, 1, 4, "two\n");
+    markdown_increment_version(doc);
+    
+    size_t len = 0;
+    char *text = markdown_flatten_range(doc, 2, 5, &len);
+    TEST_ASSERT(text && len == 5 && strcmp(text, "e\ntwo") == 0, 
+                "Byte range spanning segments is copied");
+    free(text);
+    text = markdown_flatten_range(doc, 10, 50, &len);
+    TEST_ASSERT(text && len == 4 && strcmp(text, "ree\n") == 0, 
+                "Byte range past the end is clamped");
+    free(text);
+    TEST_ASSERT(markdown_flatten_range(doc, 15, 1, &len) == NULL, 
+                "Start past the end is rejected");
+    
+    size_t start = 0;
+    TEST_ASSERT(markdown_line_range(doc, 1, 2, &start, &len) == SUCCESS && 
+                start == 4 && len == 4, "Line range covers one line");
+    TEST_ASSERT(markdown_line_range(doc, 2, 9, &start, &len) == SUCCESS && 
+                start == 8 && len == 6, "Line range runs to the end");
+    TEST_ASSERT(markdown_line_range(doc, 5, 6, &start, &len) != SUCCESS, 
+                "Line past the end is rejected");
+    
+    markdown_free(doc);
+    return 0;
+}
+
+// Test 17: Rolling back to a savepoint undoes only the edits after it
+int test_savepoint_rollback(void) {
+    printf("\n=== Test 17: Savepoint Rollback ===\n");
+    
+    document *doc = markdown_init();
+    document *expected = markdown_init();
+    markdown_insert(doc, 0, 0, "hello brave new world");
+    markdown_insert(expected, 0, 0, "hello brave new world");
+    markdown_increment_version(doc);
+    markdown_increment_version(expected);
+    
+    // Before the savepoint: kept
+    markdown_insert(doc, 1, 6, "very ");
+    markdown_delete(doc, 1, 12, 4);
+    markdown_insert(expected, 1, 6, "very ");
+    markdown_delete(expected, 1, 12, 4);
+    
+    markdown_savepoint(doc);
+    markdown_insert(doc, 1, 8, "XX");
+    markdown_delete(doc, 1, 0, 3);
+    markdown_bold(doc, 1, 16, 21);
+    markdown_insert(doc, 1, 6, "first ");
+    markdown_ordered_list(doc, 1, 0);
+    markdown_rollback(doc);
+    
+    md_stats a;
+    md_stats b;
+    markdown_stats(doc, &a);
+    markdown_stats(expected, &b);
+    TEST_ASSERT(a.working_segments == b.working_segments && 
+                a.working_bytes == b.working_bytes && 
+                a.segments[PENDING_INS] == b.segments[PENDING_INS] && 
+                a.segments[PENDING_DEL] == b.segments[PENDING_DEL], 
+                "Rollback restores the working list before the savepoint");
+    
+    // Edits after a rollback still land where they should
+    markdown_insert(doc, 1, 21, "!");
+    markdown_insert(expected, 1, 21, "!");
+    markdown_increment_version(doc);
+    markdown_increment_version(expected);
+    char *flat = markdown_flatten(doc);
+    char *want = markdown_flatten(expected);
+    TEST_ASSERT(strcmp(flat, want) == 0 && 
+                strcmp(flat, "hello very brave world!") == 0, 
+                "Committed document keeps only the edits before the savepoint");
+    free(flat);
+    free(want);
+    
+    // A savepoint with no pending edits rolls back to none
+    markdown_savepoint(doc);
+    markdown_delete(doc, 2, 0, 6);
+    markdown_rollback(doc);
+    markdown_increment_version(doc);
+    flat = markdown_flatten(doc);
+    TEST_ASSERT(strcmp(flat, "hello very brave world!") == 0, 
+                "Rollback without earlier edits leaves the document as is");
+    free(flat);
+    
+    markdown_free(doc);
+    markdown_free(expected);
+    return 0;
+}
+
+// Test 18: The position index patched at each commit matches the text
+int test_index_across_commits(void) {
+    printf("\n=== Test 18: Position Index Across Commits ===\n");
+    
+    const char *pieces[] = {"ab", "line\n", "\xc3\xa9t\xc3\xa9", "\n\n", 
+                            "a much longer piece of text that goes to the "
+                            "add buffer\n"};
+    document *doc = markdown_init();
+    markdown_insert(doc, 0, 0, "start\n");
+    markdown_increment_version(doc);
+    unsigned int seed = 18;
+    int ranges_ok = 1;
+    int lines_ok = 1;
+    int cps_ok = 1;
+    for (int round = 0; round < 300; round++) {
+        uint64_t v = doc->current_version;
+        size_t len = 0;
+        char *flat = markdown_flatten_range(doc, 0, SIZE_MAX, &len);
+        for (int e = 0; e < 4; e++) {
+            size_t pos = len ? (size_t)rand_r(&seed) % (len + 1) : 0;
+            if (rand_r(&seed) % 3 == 0 && len > 0) {
+                markdown_delete(doc, v, pos, (size_t)rand_r(&seed) % 40);
+            } else {
+                markdown_insert(doc, v, pos, pieces[rand_r(&seed) % 5]);
+            }
+        }
+        if (round % 50 == 49) {
+            markdown_delete(doc, v, 0, len / 2); // Leaves dead text
+        }
+        free(flat);
+        markdown_increment_version(doc);
+        
+        flat = markdown_flatten_range(doc, 0, SIZE_MAX, &len);
+        size_t start = len ? (size_t)rand_r(&seed) % len : 0;
+        size_t n = (size_t)rand_r(&seed) % 300;
+        size_t got_len = 0;
+        char *got = markdown_flatten_range(doc, start, n, &got_len);
+        size_t want_len = (n < len - start) ? n : len - start;
+        ranges_ok &= (got && got_len == want_len && 
+                      memcmp(got, flat + start, want_len) == 0);
+        free(got);
+        
+        size_t line = 0;
+        size_t cp = 0;
+        for (size_t i = 0; i <= len; i++) {
+            size_t off = 0;
+            if (i == 0 || flat[i - 1] == '\n') {
+                lines_ok &= (markdown_offset_of_line(doc, line++, &off) == 
+                             SUCCESS && off == i);
+            }
+            if (i == len || (flat[i] & 0xC0) != 0x80) {
+                size_t back = 0;
+                cps_ok &= (markdown_cp_to_byte(doc, cp, &off) == SUCCESS && 
+                           off == i && 
+                           markdown_byte_to_cp(doc, i, &back) == SUCCESS &&
+                           back == cp);
+                cp++;
+            }
+        }
+        lines_ok &= (markdown_offset_of_line(doc, line, &start) != SUCCESS);
+        free(flat);
+    }
+    TEST_ASSERT(ranges_ok, "Range reads match the text after every commit");
+    TEST_ASSERT(lines_ok, "Line offsets match the text after every commit");
+    TEST_ASSERT(cps_ok, "Code-point offsets match the text after every commit");
+    
+    markdown_free(doc);
+    return 0;
+}
+
+// Test 19: Edits held over when a batch is split keep their meaning
+int test_split_batch(void) {
+    printf("\n=== Test 19: Split Batch ===\n");
+    
+    // The whole batch in one version, as the reference
+    document *whole = markdown_init();
+    markdown_insert(whole, 0, 0, "hello world");
+    markdown_increment_version(whole);
+    markdown_insert(whole, 1, 0, "abc");
+    markdown_insert(whole, 1, 11, "X");
+    markdown_delete(whole, 1, 0, 1);
+    markdown_delete(whole, 1, 6, 5);
+    markdown_insert(whole, 1, 5, "!");
+    markdown_increment_version(whole);
+    char *want = markdown_flatten(whole);
+    
+    // Cut after the two inserts: the rest is rebased, then applied in 
+    // the next version as the server does
+    document *doc = markdown_init();
+    markdown_insert(doc, 0, 0, "hello world");
+    markdown_increment_version(doc);
+    markdown_insert(doc, 1, 0, "abc");
+    markdown_insert(doc, 1, 11, "X");
+    size_t pos[] = {0, 1, 6, 11, 5, 99};
+    const char ends[] = {0, 1, 0, 1, 0, 0};
+    markdown_transform_positions(doc, pos, ends, 6);
+    TEST_ASSERT(pos[0] == 3 && pos[1] == 4 && pos[2] == 9 && pos[4] == 8,
+                "Held-over positions move past text inserted before them");
+    TEST_ASSERT(pos[3] == 14, "A range end stays before text inserted at it");
+    TEST_ASSERT(pos[5] == 103, "A position past the end stays past it");
+    markdown_increment_version(doc);
+    markdown_delete(doc, 2, pos[0], pos[1] - pos[0]);
+    markdown_delete(doc, 2, pos[2], pos[3] - pos[2]);
+    markdown_insert(doc, 2, pos[4], "!");
+    markdown_increment_version(doc);
+    char *got = markdown_flatten(doc);
+    TEST_ASSERT(strcmp(got, "abcello! X") == 0 && strcmp(got, want) == 0, 
+                "Split batch gives the same text as one version");
+    
+    free(want);
+    free(got);
+    markdown_free(whole);
+    markdown_free(doc);
+    return 0;
+}
+
 int main() {
     printf("=== ACTUAL Server.c Function Unit Tests ===\n");
     printf("Testing real server.c functions by linking to them directly\n");
@@ -213,6 +793,20 @@ int main() {
     test_actual_save_document();
     test_command_queue_functions();
     test_fifo_creation_logic();
+    test_transform_position();
+    test_codepoint_positions();
+    test_memory_stats();
+    test_localized_edits();
+    test_line_offsets();
+    test_replace_all();
+    test_move_copy();
+    test_multi_cursor();
+    test_discard_pending();
+    test_region_shards();
+    test_range_reads();
+    test_savepoint_rollback();
+    test_index_across_commits();
+    test_split_batch();
     
     printf("\n=== Test Summary ===\n");
     printf("Passed: %d/%d tests\n", tests_passed, tests_total);
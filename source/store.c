@@ -0,0 +1,261 @@
+#include "../libs/store.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+static const char *schema_sql =
+    "PRAGMA journal_mode=WAL;"
+    "PRAGMA synchronous=NORMAL;"
+    "CREATE TABLE IF NOT EXISTS runs ("
+    "  run INTEGER PRIMARY KEY,"
+    "  started_at INTEGER NOT NULL);"
+    "CREATE TABLE IF NOT EXISTS versions ("
+    "  run INTEGER NOT NULL,"
+    "  version INTEGER NOT NULL,"
+    "  committed_at INTEGER NOT NULL,"
+    "  edit_count INTEGER NOT NULL,"
+    "  PRIMARY KEY (run, version));"
+    "CREATE TABLE IF NOT EXISTS edits ("
+    "  run INTEGER NOT NULL,"
+    "  version INTEGER NOT NULL,"
+    "  seq INTEGER NOT NULL,"
+    "  username TEXT NOT NULL,"
+    "  command TEXT NOT NULL,"
+    "  result TEXT NOT NULL,"
+    "  PRIMARY KEY (run, version, seq));"
+    "CREATE INDEX IF NOT EXISTS edits_by_user "
+    "  ON edits (run, username, version);"
+    "CREATE TABLE IF NOT EXISTS snapshots ("
+    "  run INTEGER NOT NULL,"
+    "  version INTEGER NOT NULL,"
+    "  content BLOB NOT NULL,"
+    "  PRIMARY KEY (run, version));";
+
+static sqlite3 *db = NULL;
+static sqlite3_int64 run_id = 0;
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Statements prepared once at open
+static sqlite3_stmt *insert_version = NULL;
+static sqlite3_stmt *insert_edit = NULL;
+static sqlite3_stmt *insert_snapshot = NULL;
+static sqlite3_stmt *query_all = NULL;
+static sqlite3_stmt *query_user = NULL;
+
+// Batch in progress
+static sqlite3_int64 batch_version = 0;
+static int batch_edits = 0;
+static int batch_open = 0;
+
+static int exec_sql(const char *sql) {
+    char *err = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+        fprintf(stderr, "store: %s\n", err ? err : sqlite3_errmsg(db));
+        sqlite3_free(err);
+        return -1;
+    }
+    return 0;
+}
+
+static int prepare(const char *sql, sqlite3_stmt **stmt) {
+    if (sqlite3_prepare_v2(db, sql, -1, stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "store: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Run a prepared insert and reset it for the next use
+ */
+static int step_done(sqlite3_stmt *stmt) {
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "store: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
+
+static void finalize_all(void) {
+    sqlite3_finalize(insert_version);
+    sqlite3_finalize(insert_edit);
+    sqlite3_finalize(insert_snapshot);
+    sqlite3_finalize(query_all);
+    sqlite3_finalize(query_user);
+    insert_version = insert_edit = insert_snapshot = NULL;
+    query_all = query_user = NULL;
+}
+
+// === Lifecycle ===
+
+int store_open(const char *path) {
+    pthread_mutex_lock(&store_mutex);
+    if (db) {
+        pthread_mutex_unlock(&store_mutex);
+        return 0;
+    }
+    if (sqlite3_open(path, &db) != SQLITE_OK) {
+        fprintf(stderr, "store: cannot open %s: %s\n", path,
+                sqlite3_errmsg(db));
+        sqlite3_close(db);
+        db = NULL;
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    sqlite3_busy_timeout(db, 1000);
+
+    char run_sql[96];
+    snprintf(run_sql, sizeof(run_sql),
+             "INSERT INTO runs (started_at) VALUES (%lld);",
+             (long long)time(NULL));
+    if (exec_sql(schema_sql) < 0 || exec_sql(run_sql) < 0 ||
+        prepare("INSERT INTO versions VALUES (?1, ?2, ?3, ?4);",
+                &insert_version) < 0 ||
+        prepare("INSERT INTO edits VALUES (?1, ?2, ?3, ?4, ?5, ?6);",
+                &insert_edit) < 0 ||
+        prepare("INSERT OR REPLACE INTO snapshots VALUES (?1, ?2, ?3);",
+                &insert_snapshot) < 0 ||
+        prepare("SELECT version, username, command, result FROM edits "
+                "WHERE run = ?1 AND version BETWEEN ?2 AND ?3 "
+                "ORDER BY version, seq;", &query_all) < 0 ||
+        prepare("SELECT version, username, command, result FROM edits "
+                "WHERE run = ?1 AND username = ?4 "
+                "AND version BETWEEN ?2 AND ?3 "
+                "ORDER BY version, seq;", &query_user) < 0) {
+        finalize_all();
+        sqlite3_close(db);
+        db = NULL;
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    run_id = sqlite3_last_insert_rowid(db);
+    pthread_mutex_unlock(&store_mutex);
+    return 0;
+}
+
+void store_close(void) {
+    pthread_mutex_lock(&store_mutex);
+    if (db) {
+        if (batch_open) {
+            exec_sql("ROLLBACK;");
+            batch_open = 0;
+        }
+        finalize_all();
+        sqlite3_close(db);
+        db = NULL;
+    }
+    pthread_mutex_unlock(&store_mutex);
+}
+
+int store_is_open(void) {
+    pthread_mutex_lock(&store_mutex);
+    int open = (db != NULL);
+    pthread_mutex_unlock(&store_mutex);
+    return open;
+}
+
+// === Batches ===
+
+/**
+ * The store lock is held from begin to commit, so a batch is never
+ * interleaved with a snapshot or query on the same connection
+ */
+int store_begin_batch(uint64_t version) {
+    pthread_mutex_lock(&store_mutex);
+    if (!db || exec_sql("BEGIN;") < 0) {
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    batch_version = (sqlite3_int64)version;
+    batch_edits = 0;
+    batch_open = 1;
+    return 0;
+}
+
+int store_record_edit(const char *username, const char *command,
+                      const char *result) {
+    if (!batch_open) {
+        return -1;
+    }
+    sqlite3_bind_int64(insert_edit, 1, run_id);
+    sqlite3_bind_int64(insert_edit, 2, batch_version);
+    sqlite3_bind_int(insert_edit, 3, batch_edits);
+    sqlite3_bind_text(insert_edit, 4, username, -1, SQLITE_STATIC);
+    sqlite3_bind_text(insert_edit, 5, command, -1, SQLITE_STATIC);
+    sqlite3_bind_text(insert_edit, 6, result, -1, SQLITE_STATIC);
+    batch_edits++;
+    return step_done(insert_edit);
+}
+
+int store_commit_batch(void) {
+    if (!batch_open) {
+        return -1;
+    }
+    sqlite3_bind_int64(insert_version, 1, run_id);
+    sqlite3_bind_int64(insert_version, 2, batch_version);
+    sqlite3_bind_int64(insert_version, 3, (sqlite3_int64)time(NULL));
+    sqlite3_bind_int(insert_version, 4, batch_edits);
+    int rc = step_done(insert_version);
+    rc = (rc == 0) ? exec_sql("COMMIT;") : -1;
+    if (rc < 0) {
+        exec_sql("ROLLBACK;");
+    }
+    batch_open = 0;
+    pthread_mutex_unlock(&store_mutex);
+    return rc;
+}
+
+int store_snapshot(uint64_t version, const char *content, size_t len) {
+    pthread_mutex_lock(&store_mutex);
+    if (!db) {
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    sqlite3_bind_int64(insert_snapshot, 1, run_id);
+    sqlite3_bind_int64(insert_snapshot, 2, (sqlite3_int64)version);
+    sqlite3_bind_blob64(insert_snapshot, 3, content, len, SQLITE_STATIC);
+    int rc = step_done(insert_snapshot);
+    pthread_mutex_unlock(&store_mutex);
+    return rc;
+}
+
+// === Queries ===
+
+long store_query_edits(const char *username, uint64_t from, uint64_t to,
+                       store_edit_fn fn, void *ctx) {
+    pthread_mutex_lock(&store_mutex);
+    if (!db) {
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    // Versions are stored as signed 64-bit integers
+    if (to > (uint64_t)INT64_MAX) {
+        to = (uint64_t)INT64_MAX;
+    }
+    sqlite3_stmt *stmt = username ? query_user : query_all;
+    sqlite3_bind_int64(stmt, 1, run_id);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)from);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)to);
+    if (username) {
+        sqlite3_bind_text(stmt, 4, username, -1, SQLITE_STATIC);
+    }
+
+    long count = 0;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        fn((uint64_t)sqlite3_column_int64(stmt, 0),
+           (const char *)sqlite3_column_text(stmt, 1),
+           (const char *)sqlite3_column_text(stmt, 2),
+           (const char *)sqlite3_column_text(stmt, 3), ctx);
+        count++;
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    pthread_mutex_unlock(&store_mutex);
+    return rc == SQLITE_DONE ? count : -1;
+}
@@ -0,0 +1,398 @@
+#include "../libs/text_scan.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Byte accumulators overflow after 255 blocks; fold them before that
+#define ACC_BLOCKS 255
+#define ADLER_MOD 65521
+// Largest n for which 255 n (n + 1) / 2 + (n + 1) (ADLER_MOD - 1) fits 
+// in 32 bits, so sums are reduced once per block
+#define ADLER_NMAX 5552
+
+typedef struct {
+    size_t (*count_codepoints)(const char *buf, size_t len);
+    size_t (*find_newline)(const char *buf, size_t len);
+    size_t (*rfind_newline)(const char *buf, size_t len);
+    size_t (*count_newlines)(const char *buf, size_t len);
+} text_kernels;
+
+// === Scalar kernels ===
+
+int text_is_continuation(char byte) {
+    return ((unsigned char)byte & 0xC0) == 0x80;
+}
+
+static size_t count_codepoints_scalar(const char *buf, size_t len) {
+    size_t continuation = 0;
+    for (size_t i = 0; i < len; i++) {
+        continuation += (size_t)text_is_continuation(buf[i]);
+    }
+    return len - continuation;
+}
+
+static size_t find_newline_scalar(const char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '\n') {
+            return i;
+        }
+    }
+    return TEXT_NPOS;
+}
+
+static size_t rfind_newline_scalar(const char *buf, size_t len) {
+    while (len > 0) {
+        len--;
+        if (buf[len] == '\n') {
+            return len;
+        }
+    }
+    return TEXT_NPOS;
+}
+
+static size_t count_newlines_scalar(const char *buf, size_t len) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += (buf[i] == '\n');
+    }
+    return count;
+}
+
+static const text_kernels scalar_kernels = {
+    count_codepoints_scalar, find_newline_scalar, rfind_newline_scalar,
+    count_newlines_scalar
+};
+
+#ifdef HAVE_X86_SIMD
+
+// === SSE2 kernels (16 bytes per step) ===
+
+/**
+ * Count bytes matching a compare in byte-wide accumulators (each match
+ * subtracts -1) and fold them with a sum of absolute differences every
+ * ACC_BLOCKS steps, so there is no movemask or popcount per block
+ */
+__attribute__((target("sse2")))
+static size_t count_codepoints_sse2(const char *buf, size_t len) {
+    const __m128i limit = _mm_set1_epi8(-64);  // 0x80-0xBF are below it
+    const __m128i zero = _mm_setzero_si128();
+    size_t continuation = 0;
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        __m128i acc = zero;
+        for (int b = 0; b < ACC_BLOCKS && i + 16 <= len; b++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmplt_epi8(v, limit));
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        continuation += (size_t)_mm_cvtsi128_si32(sums) +
+                        (size_t)_mm_extract_epi16(sums, 4);
+    }
+    return (i - continuation) + count_codepoints_scalar(buf + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t find_newline_sse2(const char *buf, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    size_t rest = find_newline_scalar(buf + i, len - i);
+    return rest == TEXT_NPOS ? TEXT_NPOS : i + rest;
+}
+
+__attribute__((target("sse2")))
+static size_t rfind_newline_sse2(const char *buf, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = len;
+    while (i >= 16) {
+        i -= 16;
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask) {
+            return i + 31 - (size_t)__builtin_clz(mask);
+        }
+    }
+    return rfind_newline_scalar(buf, i);
+}
+
+__attribute__((target("sse2")))
+static size_t count_newlines_sse2(const char *buf, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    size_t count = 0;
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        __m128i acc = zero;
+        for (int b = 0; b < ACC_BLOCKS && i + 16 <= len; b++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (size_t)_mm_cvtsi128_si32(sums) +
+                 (size_t)_mm_extract_epi16(sums, 4);
+    }
+    return count + count_newlines_scalar(buf + i, len - i);
+}
+
+static const text_kernels sse2_kernels = {
+    count_codepoints_sse2, find_newline_sse2, rfind_newline_sse2,
+    count_newlines_sse2
+};
+
+// === AVX2 kernels (32 bytes per step) ===
+// Tails are finished with the scalar kernels: calling the legacy-encoded
+// SSE2 versions from here costs an AVX-SSE transition on every call
+
+__attribute__((target("avx2")))
+static size_t sum_bytes_avx2(__m256i acc) {
+    __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+    return (size_t)_mm256_extract_epi64(sums, 0) +
+           (size_t)_mm256_extract_epi64(sums, 1) +
+           (size_t)_mm256_extract_epi64(sums, 2) +
+           (size_t)_mm256_extract_epi64(sums, 3);
+}
+
+__attribute__((target("avx2")))
+static size_t count_codepoints_avx2(const char *buf, size_t len) {
+    const __m256i limit = _mm256_set1_epi8(-64);
+    size_t continuation = 0;
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int b = 0; b < ACC_BLOCKS && i + 32 <= len; b++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(limit, v));
+        }
+        continuation += sum_bytes_avx2(acc);
+    }
+    return (i - continuation) + count_codepoints_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_newline_avx2(const char *buf, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned mask =
+            (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    size_t rest = find_newline_scalar(buf + i, len - i);
+    return rest == TEXT_NPOS ? TEXT_NPOS : i + rest;
+}
+
+__attribute__((target("avx2")))
+static size_t rfind_newline_avx2(const char *buf, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = len;
+    while (i >= 32) {
+        i -= 32;
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned mask =
+            (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask) {
+            return i + 31 - (size_t)__builtin_clz(mask);
+        }
+    }
+    return rfind_newline_scalar(buf, i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char *buf, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int b = 0; b < ACC_BLOCKS && i + 32 <= len; b++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+        }
+        count += sum_bytes_avx2(acc);
+    }
+    return count + count_newlines_scalar(buf + i, len - i);
+}
+
+static const text_kernels avx2_kernels = {
+    count_codepoints_avx2, find_newline_avx2, rfind_newline_avx2,
+    count_newlines_avx2
+};
+
+#endif // HAVE_X86_SIMD
+
+// === Dispatch ===
+
+static const text_kernels *kernels = &scalar_kernels;
+static int active_isa = TEXT_SCAN_SCALAR;
+
+static int cpu_supports(int isa) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    switch (isa) {
+        case TEXT_SCAN_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case TEXT_SCAN_SSE2:
+            return __builtin_cpu_supports("sse2");
+        default:
+            return isa == TEXT_SCAN_SCALAR;
+    }
+#else
+    return isa == TEXT_SCAN_SCALAR;
+#endif
+}
+
+int text_scan_set_isa(int isa) {
+    if (!cpu_supports(isa)) {
+        return -1;
+    }
+#ifdef HAVE_X86_SIMD
+    kernels = (isa == TEXT_SCAN_AVX2) ? &avx2_kernels
+            : (isa == TEXT_SCAN_SSE2) ? &sse2_kernels
+            : &scalar_kernels;
+#endif
+    active_isa = isa;
+    return 0;
+}
+
+/**
+ * Pick the widest supported kernels before main runs, so lookups never
+ * race with selection
+ */
+__attribute__((constructor))
+static void text_scan_init(void) {
+    const char *forced = getenv("TEXT_SCAN_ISA");
+    for (int isa = TEXT_SCAN_AVX2; isa >= TEXT_SCAN_SCALAR; isa--) {
+        if (forced && strcmp(forced, text_scan_isa_name(isa)) != 0) {
+            continue;
+        }
+        if (text_scan_set_isa(isa) == 0) {
+            return;
+        }
+    }
+}
+
+int text_scan_isa(void) {
+    return active_isa;
+}
+
+const char *text_scan_isa_name(int isa) {
+    switch (isa) {
+        case TEXT_SCAN_AVX2:
+            return "avx2";
+        case TEXT_SCAN_SSE2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+// === Public API ===
+
+size_t text_count_codepoints(const char *buf, size_t len) {
+    return kernels->count_codepoints(buf, len);
+}
+
+size_t text_codepoint_offset(const char *buf, size_t len, size_t n) {
+    size_t seen = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!text_is_continuation(buf[i])) {
+            if (seen == n) {
+                return i;
+            }
+            seen++;
+        }
+    }
+    return len;
+}
+
+size_t text_find_newline(const char *buf, size_t len) {
+    return kernels->find_newline(buf, len);
+}
+
+size_t text_rfind_newline(const char *buf, size_t len) {
+    return kernels->rfind_newline(buf, len);
+}
+
+size_t text_count_newlines(const char *buf, size_t len) {
+    return kernels->count_newlines(buf, len);
+}
+
+/**
+ * List prefixes are a handful of bytes, so this stays scalar
+ */
+size_t text_match_list_prefix(const char *buf, size_t len, int *number) {
+    size_t n = 0;
+    int value = 0;
+    while (n < len && buf[n] >= '0' && buf[n] <= '9') {
+        if (value <= (INT_MAX - 9) / 10) {
+            value = value * 10 + (buf[n] - '0');
+        }
+        n++;
+    }
+    if (n == 0 || n + 2 > len || buf[n] != '.' || buf[n + 1] != ' ') {
+        return 0;
+    }
+    if (number) {
+        *number = value;
+    }
+    return n + 2;
+}
+
+/**
+ * Sums are reduced modulo ADLER_MOD once per ADLER_NMAX bytes; the inner
+ * loop is left to the compiler to unroll
+ */
+uint32_t text_adler32(uint32_t adler, const char *buf, size_t len) {
+    const unsigned char *p = (const unsigned char *)buf;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (len > 0) {
+        size_t n = (len < ADLER_NMAX) ? len : ADLER_NMAX;
+        len -= n;
+        for (size_t i = 0; i < n; i++) {
+            a += p[i];
+            b += a;
+        }
+        p += n;
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return (b << 16) | a;
+}
+
+/**
+ * Same arithmetic as zlib's adler32_combine: the second range's sums are
+ * shifted as if its bytes had been added after the first range's
+ */
+uint32_t text_adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+    uint32_t rem = (uint32_t)(len2 % ADLER_MOD);
+    uint32_t a1 = adler1 & 0xFFFF;
+    uint32_t b1 = adler1 >> 16;
+    uint32_t a2 = adler2 & 0xFFFF;
+    uint32_t b2 = adler2 >> 16;
+
+    uint32_t a = a1 + a2 + ADLER_MOD - 1;
+    uint32_t b = (uint32_t)(((uint64_t)rem * a1) % ADLER_MOD);
+    b += b1 + b2 + ADLER_MOD - rem;
+    a %= ADLER_MOD;
+    b %= ADLER_MOD;
+    return (b << 16) | a;
+}
@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../libs/text_scan.h"
+#include "../libs/markdown.h"
+
+/**
+ * Throughput of the text_scan kernels for each instruction set the CPU
+ * supports, on a generated multi-megabyte markdown document, plus the 
+ * block commands that use them. Usage: text_scan_bench [megabytes]
+ */
+
+#define DEFAULT_MB 8
+#define ROUNDS 20
+#define COMMAND_ROUNDS 5
+
+static volatile size_t sink;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Paragraph lines of mixed ASCII and UTF-8 text, about 80 bytes each
+static char *make_text(size_t len) {
+    static const char *lines[] = {
+        "Lorem ipsum dolor sit amet, consectetur adipiscing elit sed do.\n",
+        "Caf\xc3\xa9 na\xc3\xafve r\xc3\xa9sum\xc3\xa9 \xe4\xb8\x96\xe7\x95\x8c "
+        "\xe3\x81\x93\xe3\x82\x93\xe3\x81\xab\xe3\x81\xa1\xe3\x81\xaf text.\n",
+        "1. list item with a trailing sentence that runs on for a while\n",
+    };
+    char *buf = (char *)malloc(len + 1);
+    size_t off = 0;
+    for (size_t i = 0; off < len; i++) {
+        const char *line = lines[i % 3];
+        size_t n = strlen(line);
+        if (n > len - off) {
+            n = len - off;
+        }
+        memcpy(buf + off, line, n);
+        off += n;
+    }
+    buf[len] = 0;
+    return buf;
+}
+
+static void bench_kernels(const char *text, size_t len) {
+    // A newline-free copy makes the backward scan cover the whole buffer
+    char *flat_line = (char *)malloc(len);
+    for (size_t i = 0; i < len; i++) {
+        flat_line[i] = (text[i] == '\n') ? ' ' : text[i];
+    }
+
+    printf("%-8s %12s %12s %12s %12s\n", "isa", "codepoints", "count_nl",
+           "find_nl", "rfind_nl");
+    for (int isa = TEXT_SCAN_SCALAR; isa <= TEXT_SCAN_AVX2; isa++) {
+        if (text_scan_set_isa(isa) < 0) {
+            continue;
+        }
+        double gbs[4];
+        for (int k = 0; k < 4; k++) {
+            double start = now_sec();
+            for (int r = 0; r < ROUNDS; r++) {
+                switch (k) {
+                    case 0:
+                        sink += text_count_codepoints(text, len);
+                        break;
+                    case 1:
+                        sink += text_count_newlines(text, len);
+                        break;
+                    case 2:
+                        // Walk every line, as a renumbering scan does
+                        for (size_t off = 0, nl; off < len; off += nl + 1) {
+                            nl = text_find_newline(text + off, len - off);
+                            if (nl == TEXT_NPOS) {
+                                break;
+                            }
+                            sink += nl;
+                        }
+                        break;
+                    default:
+                        sink += text_rfind_newline(flat_line, len);
+                        break;
+                }
+            }
+            gbs[k] = (double)len * ROUNDS / (now_sec() - start) / 1e9;
+        }
+        printf("%-8s %9.2f GB/s %7.2f GB/s %7.2f GB/s %7.2f GB/s\n",
+               text_scan_isa_name(isa), gbs[0], gbs[1], gbs[2], gbs[3]);
+    }
+    free(flat_line);
+}
+
+static int bench_commands(const char *text, size_t len) {
+    // Both commands go to the start of a line, found again each round as
+    // the prefixes they add move it; line numbers stay the same
+    size_t ordered_line = text_count_newlines(text, len / 2);
+    size_t quote_line = text_count_newlines(text, len / 3);
+
+    printf("\n%-8s %16s %16s %16s\n", "isa", "ORDERED_LIST", "BLOCKQUOTE",
+           "cp_to_byte");
+    for (int isa = TEXT_SCAN_SCALAR; isa <= TEXT_SCAN_AVX2; isa++) {
+        if (text_scan_set_isa(isa) < 0) {
+            continue;
+        }
+        document *doc = markdown_init();
+        markdown_insert(doc, doc->current_version, 0, text);
+        markdown_increment_version(doc);
+
+        // Best of a few committed rounds
+        double ordered = 1e9;
+        double quote = 1e9;
+        for (int r = 0; r < COMMAND_ROUNDS; r++) {
+            size_t pos = 0;
+            markdown_offset_of_line(doc, ordered_line, &pos);
+            double start = now_sec();
+            int ordered_ret = markdown_ordered_list(doc, doc->current_version,
+                                                    pos);
+            double t = now_sec() - start;
+            ordered = (t < ordered) ? t : ordered;
+            markdown_increment_version(doc);
+
+            markdown_offset_of_line(doc, quote_line, &pos);
+            start = now_sec();
+            int quote_ret = markdown_blockquote(doc, doc->current_version, 
+                                                pos);
+            t = now_sec() - start;
+            quote = (t < quote) ? t : quote;
+            markdown_increment_version(doc);
+
+            if (ordered_ret != SUCCESS || quote_ret != SUCCESS) {
+                fprintf(stderr, "block command refused: ORDERED_LIST %d, "
+                        "BLOCKQUOTE %d\n", ordered_ret, quote_ret);
+                markdown_free(doc);
+                return -1;
+            }
+        }
+
+        size_t byte = 0;
+        double start = now_sec();
+        for (size_t cp = 0; cp < 100000; cp++) {
+            markdown_cp_to_byte(doc, (cp * 7919) % (len / 2), &byte);
+            sink += byte;
+        }
+        double lookup = (now_sec() - start) / 100000;
+
+        printf("%-8s %13.2f ms %13.2f ms %13.0f ns\n", text_scan_isa_name(isa),
+               ordered * 1e3, quote * 1e3, lookup * 1e9);
+        markdown_free(doc);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t mb = (argc > 1) ? (size_t)atoi(argv[1]) : DEFAULT_MB;
+    if (mb == 0) {
+        mb = DEFAULT_MB;
+    }
+    size_t len = mb << 20;
+    char *text = make_text(len);
+
+    printf("text_scan benchmark, %zu MB document, default isa %s\n\n", mb,
+           text_scan_isa_name(text_scan_isa()));
+    bench_kernels(text, len);
+    int ret = bench_commands(text, len);
+
+    free(text);
+    return (ret < 0) ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+#include "../libs/timer_wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_MAX_DELTA \
+    (((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+// === Helper Functions ===
+
+/**
+ * Unlink a node from whatever slot it is in
+ */
+static void unlink_node(timer_node *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+/**
+ * Place a node in the slot matching its distance from now. Timers further
+ * out than the wheel covers wait in the last slot of the top level and
+ * are cascaded down again when reached
+ */
+static void place_node(timer_wheel *wheel, timer_node *node) {
+    uint64_t expires = node->expires;
+    uint64_t delta = expires - wheel->now;
+    if (delta > TIMER_WHEEL_MAX_DELTA) {
+        expires = wheel->now + TIMER_WHEEL_MAX_DELTA;
+        delta = TIMER_WHEEL_MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    size_t slot = (size_t)(expires >> (TIMER_WHEEL_BITS * level)) &
+                  TIMER_WHEEL_MASK;
+
+    timer_node *head = &wheel->slots[level][slot];
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+/**
+ * Move every timer in a coarse slot down to a finer level
+ */
+static void cascade(timer_wheel *wheel, int level, size_t slot) {
+    timer_node *head = &wheel->slots[level][slot];
+    timer_node pending = {&pending, &pending, 0, 0};
+
+    // Detach the whole slot first so re-placed nodes are not revisited
+    if (head->next == head) {
+        return;
+    }
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    head->next = head;
+    head->prev = head;
+
+    while (pending.next != &pending) {
+        timer_node *node = pending.next;
+        unlink_node(node);
+        place_node(wheel, node);
+    }
+}
+
+// === Public API ===
+
+void timer_wheel_init(timer_wheel *wheel, uint64_t now) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (size_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            timer_node *head = &wheel->slots[level][slot];
+            head->prev = head;
+            head->next = head;
+        }
+    }
+    wheel->now = now;
+}
+
+void timer_node_init(timer_node *node, int id) {
+    node->prev = NULL;
+    node->next = NULL;
+    node->expires = 0;
+    node->id = id;
+}
+
+int timer_node_pending(const timer_node *node) {
+    return node->next != NULL;
+}
+
+void timer_wheel_schedule(timer_wheel *wheel, timer_node *node,
+                          uint64_t expires) {
+    if (timer_node_pending(node)) {
+        unlink_node(node);
+    }
+    // A timer always fires on a future tick, so re-arming from inside an
+    // expiry callback cannot land in the slot being processed
+    node->expires = (expires > wheel->now) ? expires : wheel->now + 1;
+    place_node(wheel, node);
+}
+
+void timer_wheel_cancel(timer_node *node) {
+    if (timer_node_pending(node)) {
+        unlink_node(node);
+    }
+}
+
+/**
+ * Step the wheel one tick at a time up to now. On each tick the coarser
+ * slots whose period starts here are cascaded, then the level 0 slot for
+ * the tick is fired
+ */
+size_t timer_wheel_advance(timer_wheel *wheel, uint64_t now, timer_fn fn,
+                           void *ctx) {
+    size_t fired = 0;
+
+    while (wheel->now < now) {
+        wheel->now++;
+        uint64_t tick = wheel->now;
+
+        // Cascade from the top so nodes can fall more than one level
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            uint64_t period_mask =
+                ((uint64_t)1 << (TIMER_WHEEL_BITS * level)) - 1;
+            if ((tick & period_mask) == 0) {
+                cascade(wheel, level, (size_t)(tick >>
+                        (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+            }
+        }
+
+        timer_node *head = &wheel->slots[0][tick & TIMER_WHEEL_MASK];
+        while (head->next != head) {
+            timer_node *node = head->next;
+            unlink_node(node);
+            fired++;
+            fn(node, ctx);
+        }
+    }
+    return fired;
+}